@@ -5,18 +5,271 @@
 #include "cbase/c_printf.h"
 #include "cbase/c_runes.h"
 #include "cstring/c_string.h"
+#include "cstring/c_ucs2.h"
+#include "cstring/private/c_simd.h"
+#include "cstring/private/c_atomic.h"
+#include "cstring/private/c_bmp.h"
 
 namespace ncore
 {
     namespace nstring_memory
     {
-        static alloc_t* s_object_alloc = nullptr;  // for instance_t and data_t, object-size = 32 bytes
+        // Allocator for the fixed size objects (instance_t, data_t and small strings), objects are carved
+        // out of page sized slabs that are aligned on their size so that a slab can be found from any of
+        // its objects. Each slab has an intrusive free list, slabs with free objects are kept in a list
+        // per size class.
+        class slab_alloc_t : public alloc_t
+        {
+        public:
+            enum
+            {
+                c_page_size   = 4096,
+                c_num_classes = 2,
+            };
+
+            void init(alloc_t* page_alloc)
+            {
+                m_page_alloc = page_alloc;
+                m_lock       = 0;
+                for (s32 i = 0; i < c_num_classes; ++i)
+                {
+                    m_classes[i].m_partial = nullptr;
+                    m_classes[i].m_count   = 0;
+                }
+            }
+
+            // Release all the slabs, all objects should have been deallocated
+            void exit()
+            {
+                for (s32 i = 0; i < c_num_classes; ++i)
+                {
+                    while (m_classes[i].m_partial != nullptr)
+                    {
+                        slab_t* slab = m_classes[i].m_partial;
+                        ASSERT(slab->m_used == 0);
+                        remove(m_classes[i], slab);
+                        m_page_alloc->deallocate(slab);
+                    }
+                }
+            }
+
+        protected:
+            struct slab_t
+            {
+                slab_t* m_next;
+                slab_t* m_prev;
+                void*   m_free;   // intrusive list of free objects
+                u16     m_used;   // number of allocated objects
+                u16     m_class;  // size class index
+                u32     m_size;   // object size
+            };
+
+            struct class_t
+            {
+                slab_t* m_partial;  // slabs that have free objects
+                s32     m_count;    // number of slabs in 'm_partial'
+            };
+
+            // Class 0 holds instance_t, data_t and the pieces of a piece table (64 bytes), class 1 holds a small string (136 bytes)
+            static s32 size_to_class(u32 size)
+            {
+                if (size <= 64)
+                    return 0;
+                ASSERT(size <= 136);
+                return 1;
+            }
+
+            static u32 class_to_size(s32 c) { return c == 0 ? 64 : 136; }
+
+            void add(class_t& c, slab_t* slab)
+            {
+                slab->m_prev = nullptr;
+                slab->m_next = c.m_partial;
+                if (c.m_partial != nullptr)
+                    c.m_partial->m_prev = slab;
+                c.m_partial = slab;
+                c.m_count++;
+            }
+
+            void remove(class_t& c, slab_t* slab)
+            {
+                if (slab->m_prev != nullptr)
+                    slab->m_prev->m_next = slab->m_next;
+                else
+                    c.m_partial = slab->m_next;
+                if (slab->m_next != nullptr)
+                    slab->m_next->m_prev = slab->m_prev;
+                c.m_count--;
+            }
+
+            slab_t* new_slab(s32 ci)
+            {
+                slab_t* slab = (slab_t*)m_page_alloc->allocate(c_page_size, c_page_size);
+                ASSERT(((uint_t)slab & ((uint_t)c_page_size - 1)) == 0);  // v_deallocate finds the slab by masking
+                slab->m_used  = 0;
+                slab->m_class = (u16)ci;
+                slab->m_size  = class_to_size(ci);
+                slab->m_free  = nullptr;
+
+                // Build the free list, objects start after the header at a 32 byte alignment
+                u8*       obj = (u8*)slab + ((sizeof(slab_t) + 31) & ~31);
+                u8* const end = (u8*)slab + c_page_size;
+                while ((obj + slab->m_size) <= end)
+                {
+                    *(void**)obj = slab->m_free;
+                    slab->m_free = obj;
+                    obj += slab->m_size;
+                }
+                return slab;
+            }
+
+            virtual void* v_allocate(u32 size, u32 alignment)
+            {
+                ASSERT(alignment <= 32);
+                natomic::scoped_lock_t lock(&m_lock);
+                s32 const              ci = size_to_class(size);
+                class_t&               c  = m_classes[ci];
+                if (c.m_partial == nullptr)
+                    add(c, new_slab(ci));
+
+                slab_t* slab = c.m_partial;
+                void*   obj  = slab->m_free;
+                slab->m_free = *(void**)obj;
+                slab->m_used++;
+                if (slab->m_free == nullptr)
+                    remove(c, slab);
+                return obj;
+            }
+
+            virtual void v_deallocate(void* ptr)
+            {
+                if (ptr == nullptr)
+                    return;
+
+                natomic::scoped_lock_t lock(&m_lock);
+                slab_t*                slab = (slab_t*)((uint_t)ptr & ~((uint_t)c_page_size - 1));
+                class_t&               c    = m_classes[slab->m_class];
+                if (slab->m_free == nullptr)
+                    add(c, slab);
+                *(void**)ptr = slab->m_free;
+                slab->m_free = ptr;
+                slab->m_used--;
+
+                // Keep one empty slab around, release the others
+                if (slab->m_used == 0 && c.m_count > 1)
+                {
+                    remove(c, slab);
+                    m_page_alloc->deallocate(slab);
+                }
+            }
+
+            alloc_t* m_page_alloc;
+            class_t  m_classes[c_num_classes];
+            u16      m_lock;  // taken while allocating or deallocating when CSTRING_THREAD_SAFE
+        };
+
+        static slab_alloc_t s_slab_alloc;
+
+        static alloc_t* s_object_alloc = nullptr;  // for instance_t, data_t and piece_t (at most 64 bytes) and small strings (at most 136 bytes)
         static alloc_t* s_string_alloc = nullptr;  // for the actual string data
 
         void init(alloc_t* object_alloc, alloc_t* string_alloc)
         {
-            s_object_alloc = object_alloc;
             s_string_alloc = string_alloc;
+            if (object_alloc == nullptr)
+            {
+                // The slab allocator takes its pages from the string allocator
+                s_slab_alloc.init(string_alloc);
+                object_alloc = &s_slab_alloc;
+            }
+            s_object_alloc = object_alloc;
+        }
+
+        void exit()
+        {
+            if (s_object_alloc == &s_slab_alloc)
+                s_slab_alloc.exit();
+            s_object_alloc = nullptr;
+            s_string_alloc = nullptr;
+        }
+
+        //------------------------------------------------------------------------------
+        static CSTRING_THREAD_LOCAL arena_scope_t* s_arena = nullptr;  // the innermost active arena scope of this thread
+
+        struct arena_scope_t::block_t
+        {
+            block_t* m_next;
+            u32      m_size;  // size of the memory following this header
+            u32      m_used;
+        };
+
+        arena_scope_t::arena_scope_t(u32 block_size)
+            : m_outer(s_arena)
+            , m_block(nullptr)
+            , m_block_size(block_size)
+        {
+            s_arena = this;
+        }
+
+        arena_scope_t::~arena_scope_t()
+        {
+            ASSERT(s_arena == this);
+            while (m_block != nullptr)
+            {
+                block_t* next = m_block->m_next;
+                s_string_alloc->deallocate(m_block);
+                m_block = next;
+            }
+            s_arena = m_outer;
+        }
+
+        void* arena_scope_t::allocate(u32 size, u32 alignment)
+        {
+            if (m_block != nullptr)
+            {
+                u32 const offset = (m_block->m_used + (alignment - 1)) & ~(alignment - 1);
+                if ((offset + size) <= m_block->m_size)
+                {
+                    m_block->m_used = offset + size;
+                    return (u8*)(m_block + 1) + offset;
+                }
+            }
+
+            u32 const block_size = math::max(m_block_size, size + alignment);
+            block_t*  block      = (block_t*)s_string_alloc->allocate(sizeof(block_t) + block_size, sizeof(block_t));
+            block->m_next        = m_block;
+            block->m_size        = block_size;
+            block->m_used        = 0;
+            m_block              = block;
+            return allocate(size, alignment);
+        }
+
+        bool arena_scope_t::owns(void const* ptr) const
+        {
+            for (block_t const* block = m_block; block != nullptr; block = block->m_next)
+            {
+                if (ptr >= (void const*)(block + 1) && ptr < (void const*)((u8 const*)(block + 1) + block->m_size))
+                    return true;
+            }
+            return false;
+        }
+
+        // Objects and runes are allocated from @arena when given, memory that belongs to an arena
+        // is not released individually. The owner of the memory records the arena it came from
+        // (data_t::m_arena, instance_t::m_arena) and passes @in_arena when freeing it.
+        static void* s_alloc_object(u32 size, arena_scope_t* arena) { return arena != nullptr ? arena->allocate(size, sizeof(void*)) : s_object_alloc->allocate(size); }
+        static void* s_alloc_runes(u32 size, arena_scope_t* arena) { return arena != nullptr ? arena->allocate(size, sizeof(void*)) : s_string_alloc->allocate(size); }
+
+        static void s_free_object(void* ptr, bool in_arena)
+        {
+            if (!in_arena)
+                s_object_alloc->deallocate(ptr);
+        }
+
+        static void s_free_runes(void* ptr, bool in_arena)
+        {
+            if (!in_arena)
+                s_string_alloc->deallocate(ptr);
         }
     };  // namespace nstring_memory
 
@@ -27,19 +280,64 @@ namespace ncore
     {
         struct range_t;
         struct data_t;
+        struct view_index_t;
+        struct edit_log_t;
+        struct piece_table_t;
 
-        struct data_t  // 24 bytes
-        {
-            ucs2::prune m_ptr;   // UCS-2
-            instance_t* m_head;  // The first view of this string, doubly linked list of instances
-            s32         m_len;
-            s32         m_ref;
+        // Small strings are allocated as one block holding the instance, the data and the runes. Such
+        // a string is never shared, when it is sliced the data is moved out into its own allocation.
+        static const u16 c_data_embedded = 0x1;  // data_t lives in the allocation of its owning instance
+        static const s32 c_sso_max_len   = 11;   // maximum number of runes stored inline (excluding terminator)
+
+        // While a string is being edited its runes may not be contiguous, they are flattened before they are read
+        static const u16 c_data_edited  = 0x2;                                           // the runes were edited since they were last read
+        static const u16 c_data_gap     = 0x4;                                           // the runes have a gap at m_gap
+        static const u16 c_data_pieces  = 0x8;                                           // the runes are held by m_pieces
+        static const u16 c_data_flatten = c_data_edited | c_data_gap | c_data_pieces;  // reading the runes as one block requires s_flatten()
+
+        // Frozen data is never modified, its views are not tracked so they can be made and released from any
+        // thread without taking its lock. A string that modifies frozen data first gets a copy of its runes.
+        static const u16 c_data_frozen = 0x10;
+
+        // A clone shares the runes of the string it was cloned from until either of them is modified, the data
+        // has c_data_clones while such clones may be among its views, they are marked with c_slot_clone.
+        static const u16 c_data_clones = 0x20;
+        static const s32 c_slot_clone  = -2;
 
-            inline s32 cap() const { return m_len; }
+        // Interned data is frozen data that is unique for its runes, see s_intern()
+        static const u16 c_data_interned = 0x40;
 
+        // The hash of all the runes is cached in m_hash, it is dropped by the first modification
+        static const u16 c_data_hashed = 0x80;
+
+        struct data_t  // 64 bytes
+        {
+            ucs2::prune                    m_ptr;    // UCS-2, not contiguous while the flags have c_data_gap or c_data_pieces
+            instance_t*                    m_head;   // The first view of this string, doubly linked list of instances
+            view_index_t*                  m_index;  // The parked views of this string, nullptr when there are none
+            edit_log_t*                    m_log;    // The edits the active views still have to catch up with, nullptr until needed
+            nstring_memory::arena_scope_t* m_arena;  // The arena of the data, its runes, edit log, view index and piece table, nullptr for the heap
+            union
+            {
+                piece_table_t* m_pieces;  // c_data_pieces, the runes of a large string that is being edited
+                s32            m_gap;     // c_data_gap, position of the gap, it holds all of the m_cap - m_len unused runes
+                u64            m_hash;    // c_data_hashed, see s_data_hash()
+            };
+            s32 m_len;    // Number of runes in use
+            s32 m_cap;    // Number of runes allocated (excluding the terminator)
+            s32 m_ref;    // Number of views, atomic when CSTRING_THREAD_SAFE
+            u16 m_flags;  // c_data_embedded, c_data_edited, c_data_gap, c_data_pieces, c_data_frozen, c_data_clones, c_data_interned, c_data_hashed
+            u16 m_lock;   // Taken while the views are tracked or brought up to date, see s_track()
+
+            inline s32  cap() const { return m_cap; }
+            inline bool is_embedded() const { return (m_flags & c_data_embedded) != 0; }
+            inline bool is_inline() const { return m_ptr == (ucs2::pcrune)(this + 1); }
+
+            // The default data is shared by everyone, it is not reference counted
             data_t* attach()
             {
-                m_ref++;
+                if (this != &s_default)
+                    natomic::inc(&m_ref);
                 return this;
             }
 
@@ -72,16 +370,24 @@ namespace ncore
                 m_from++;
                 m_to++;
             }
+            inline void move(s32 shift)
+            {
+                m_from += shift;
+                m_to += shift;
+            }
             inline bool    is_inside(range_t const& parent) const { return m_from >= parent.m_from && m_to <= parent.m_to; }
             inline range_t local() const { return {0, m_to - m_from}; }
         };
 
-        struct instance_t  // 32 bytes
+        struct instance_t  // 48 bytes
         {
-            range_t     m_range;  // [from,to] view on the string data
-            data_t*     m_data;   // reference counted string data
-            instance_t* m_next;   // doubly linked list of instances that also own 'm_data'
-            instance_t* m_prev;   // doubly linked list of instances that also own 'm_data'
+            range_t                        m_range;  // [from,to] view on the string data
+            data_t*                        m_data;   // reference counted string data
+            instance_t*                    m_next;   // doubly linked list of instances that also own 'm_data'
+            instance_t*                    m_prev;   // doubly linked list of instances that also own 'm_data'
+            nstring_memory::arena_scope_t* m_arena;  // the arena this instance was allocated from, nullptr for the heap
+            s32                            m_slot;   // slot in 'm_data->m_index' when parked, c_slot_clone for a clone, -1 otherwise
+            u32                            m_gen;    // generation of 'm_data->m_log' that 'm_range' is up to date with
 
             inline bool is_empty() const { return m_range.is_empty(); }
             inline bool is_slice() const { return m_data->m_head != nullptr; }
@@ -89,7 +395,8 @@ namespace ncore
             inline s32  size() const { return m_range.size(); }
 
             instance_t* clone_full() const;
-            instance_t* clone_slice() const;
+            instance_t* clone_slice();
+            data_t*     share();
 
             instance_t* release();
             void        invalidate();
@@ -97,8 +404,48 @@ namespace ncore
             static instance_t s_default;
         };
 
+        // An edit on a string only adjusts the view that made it (and the parked views), the other active
+        // views replay the logged edits when they are accessed, see s_sync(). Every logged edit bumps the
+        // generation, once all the active views have caught up the log is emptied.
+        static const s32 c_edit_log_max = 32;  // a full log brings all the active views up to date
+
+        struct edit_t
+        {
+            s32 m_op_code;
+            s32 m_from;
+            s32 m_to;
+        };
+
+        struct edit_log_t
+        {
+            u32    m_base;     // generation before the first edit in the log
+            s32    m_count;    // number of edits in the log
+            s32    m_active;   // number of views in the list of active views
+            s32    m_current;  // number of active views that are at the current generation
+            edit_t m_edits[c_edit_log_max];
+
+            inline u32 gen() const { return m_base + (u32)m_count; }
+
+            inline void compact()
+            {
+                if (m_current == m_active)
+                {
+                    m_base += (u32)m_count;
+                    m_count = 0;
+                }
+            }
+        };
+
         void data_t::addToList(instance_t* node)
         {
+            if (m_log != nullptr)
+            {
+                // A view joins the list with its range up to date
+                node->m_gen = m_log->gen();
+                m_log->m_active++;
+                m_log->m_current++;
+            }
+
             if (m_head == nullptr)
             {
                 m_head       = node;
@@ -127,67 +474,206 @@ namespace ncore
             {
                 m_head = nullptr;
             }
+
+            if (m_log != nullptr)
+            {
+                m_log->m_active--;
+                if (node->m_gen == m_log->gen())
+                    m_log->m_current--;
+                m_log->compact();
+            }
         }
 
         static ucs2::rune s_default_str[4]      = {0, 0, 0, 0};
-        instance_t        instance_t::s_default = {{0, 0}, &data_t::s_default, &instance_t::s_default, &instance_t::s_default};
-        data_t            data_t::s_default     = {s_default_str, &instance_t::s_default, 0, 1};
+        instance_t        instance_t::s_default = {{0, 0}, &data_t::s_default, &instance_t::s_default, &instance_t::s_default, nullptr, -1, 0};
+        data_t            data_t::s_default     = {s_default_str, &instance_t::s_default, nullptr, nullptr, nullptr, nullptr, 0, 0, 1, 0, 0};
 
         static inline bool             s_is_default_data(nstring::data_t* data) { return data == &data_t::s_default; }
         static inline nstring::data_t* s_get_default_data() { return &data_t::s_default; }
         static inline bool             s_is_default_instance(nstring::instance_t* item) { return item == &instance_t::s_default; }
         static nstring::instance_t*    s_get_default_instance() { return &instance_t::s_default; }
 
+        static inline bool s_in_arena(nstring::data_t const* data) { return data->m_arena != nullptr; }
+        static inline bool s_in_arena(nstring::instance_t const* v) { return v->m_arena != nullptr; }
+
         static nstring::data_t* s_alloc_data(s32 strlen)
         {
-            nstring::data_t* data = (nstring::data_t*)nstring_memory::s_object_alloc->allocate(sizeof(nstring::data_t));
-            data->m_ref           = 0;
+            nstring_memory::arena_scope_t* arena = nstring_memory::s_arena;
+            nstring::data_t*               data  = (nstring::data_t*)nstring_memory::s_alloc_object(sizeof(nstring::data_t), arena);
+            data->m_ref                          = 0;
 
-            ucs2::prune strdata = (ucs2::prune)nstring_memory::s_string_alloc->allocate((strlen + 1) * sizeof(ucs2::rune));
+            ucs2::prune strdata = (ucs2::prune)nstring_memory::s_alloc_runes((strlen + 1) * sizeof(ucs2::rune), arena);
             data->m_len         = strlen;
+            data->m_cap         = strlen;
             data->m_ptr         = strdata;
             data->m_head        = nullptr;
+            data->m_index       = nullptr;
+            data->m_log         = nullptr;
+            data->m_arena       = arena;
+            data->m_pieces      = nullptr;
+            data->m_flags       = 0;
+            data->m_lock        = 0;
+            strdata[strlen]     = '\0';
 
             return data;
         }
 
-        static void s_resize_data(nstring::data_t* data, s32 new_size)
+        // Reallocate the runes of @data to exactly @new_cap runes, an embedded data moves its runes
+        // back inline when they fit.
+        static void s_realloc_data(nstring::data_t* data, s32 new_cap)
         {
-            if (data->m_len < new_size)
+            ASSERT(new_cap >= data->m_len);
+            if (data->is_embedded() && new_cap <= c_sso_max_len)
             {
-                ucs2::prune newptr = (ucs2::prune)nstring_memory::s_string_alloc->allocate((new_size + 1) * sizeof(uchar16));
-                for (s32 i = 0; i < data->m_len; i++)
-                    newptr[i] = data->m_ptr[i];
-                nstring_memory::s_string_alloc->deallocate(data->m_ptr);
-                data->m_ptr           = newptr;
-                data->m_len           = new_size;
-                data->m_ptr[new_size] = '\0';
+                if (!data->is_inline())
+                {
+                    ucs2::prune inlptr = (ucs2::prune)(data + 1);
+                    nmem::memcpy(inlptr, data->m_ptr, (data->m_len + 1) * sizeof(ucs2::rune));
+                    nstring_memory::s_free_runes(data->m_ptr, s_in_arena(data));
+                    data->m_ptr = inlptr;
+                }
+                data->m_cap = c_sso_max_len;
+                return;
             }
+
+            // The runes are allocated from the same arena as their data, if any
+            ucs2::prune newptr = (ucs2::prune)nstring_memory::s_alloc_runes((new_cap + 1) * sizeof(ucs2::rune), data->m_arena);
+            nmem::memcpy(newptr, data->m_ptr, data->m_len * sizeof(ucs2::rune));
+            newptr[data->m_len] = '\0';
+            if (!data->is_inline())
+                nstring_memory::s_free_runes(data->m_ptr, s_in_arena(data));
+            data->m_ptr = newptr;
+            data->m_cap = new_cap;
+        }
+
+        // Make sure @data can hold @new_size runes, the capacity grows by a factor of 1.5 so that
+        // repeatedly appending to a string is amortized O(1).
+        static void s_resize_data(nstring::data_t* data, s32 new_size)
+        {
+            if (new_size <= data->m_cap)
+                return;
+            s32 new_cap = data->m_cap + (data->m_cap >> 1);
+            if (new_cap < new_size)
+                new_cap = new_size;
+            s_realloc_data(data, new_cap);
         }
 
-        static nstring::data_t* s_unique_data(nstring::data_t* data, u32 from, u32 to)
+        static void s_data_copy(nstring::data_t const* data, s32 from, s32 to, ucs2::prune dst);
+
+        // A copy of the runes [@from, @to) of @data, allocated from @arena or the heap when it is nullptr
+        static nstring::data_t* s_unique_data(nstring::data_t* data, u32 from, u32 to, nstring_memory::arena_scope_t* arena)
         {
             ASSERT(from <= to);
-            const s32        len     = to - from;
-            nstring::data_t* newdata = (nstring::data_t*)nstring_memory::s_object_alloc->allocate(len);
-            ucs2::prune      newptr  = (ucs2::prune)nstring_memory::s_string_alloc->allocate(len * sizeof(uchar16) + 1);
+            const s32                      len     = to - from;
+            nstring::data_t*               newdata = (nstring::data_t*)nstring_memory::s_alloc_object(sizeof(nstring::data_t), arena);
+            ucs2::prune                    newptr  = (ucs2::prune)nstring_memory::s_alloc_runes((len + 1) * sizeof(uchar16), arena);
             newdata->m_ptr           = newptr;
             newdata->m_head          = nullptr;
+            newdata->m_index         = nullptr;
+            newdata->m_log           = nullptr;
+            newdata->m_arena         = arena;
+            newdata->m_pieces        = nullptr;
             newdata->m_len           = len;
+            newdata->m_cap           = len;
             newdata->m_ref           = 0;
+            newdata->m_flags         = 0;
+            newdata->m_lock          = 0;
 
-            for (s32 i = 0; i < len; i++)
-                newptr[i] = data->m_ptr[from + i];
+            s_data_copy(data, from, to, newptr);
+            newptr[len] = '\0';
 
             return newdata;
         }
 
-        static nstring::instance_t* s_alloc_instance(nstring::range_t range, nstring::data_t* data)
+        // Start tracking @v in the list of active views of its data, the views of frozen data are not tracked
+        static void s_track(nstring::instance_t* v)
         {
-            nstring::instance_t* v = (nstring::instance_t*)nstring_memory::s_object_alloc->allocate(sizeof(nstring::instance_t));
-            v->m_range             = range;
-            v->m_data              = data->attach();
+            if ((v->m_data->m_flags & c_data_frozen) != 0)
+            {
+                v->m_next = v->m_prev = v;
+                return;
+            }
+            natomic::scoped_lock_t lock(&v->m_data->m_lock);
             v->m_data->addToList(v);
+        }
+
+        static nstring::instance_t* s_alloc_instance(nstring::range_t range, nstring::data_t* data)
+        {
+            nstring_memory::arena_scope_t* arena = nstring_memory::s_arena;
+            nstring::instance_t*           v     = (nstring::instance_t*)nstring_memory::s_alloc_object(sizeof(nstring::instance_t), arena);
+            v->m_range                           = range;
+            v->m_data                            = data->attach();
+            v->m_arena                           = arena;
+            v->m_slot                            = -1;
+            v->m_gen                             = 0;
+            if (s_is_default_data(data))
+            {
+                // The default data is shared by everyone and never modified, views on it are not tracked
+                v->m_next = v->m_prev = v;
+            }
+            else
+            {
+                s_track(v);
+            }
+            return v;
+        }
+
+        // Allocate a new string of @strlen runes, small strings get their instance, data and runes
+        // in a single allocation.
+        static nstring::instance_t* s_alloc_string(s32 strlen)
+        {
+            if (strlen > c_sso_max_len)
+                return s_alloc_instance({0, strlen}, s_alloc_data(strlen));
+
+            u32 const            size = sizeof(nstring::instance_t) + sizeof(nstring::data_t) + (c_sso_max_len + 1) * sizeof(ucs2::rune);
+            nstring::instance_t* v    = (nstring::instance_t*)nstring_memory::s_alloc_object(size, nstring_memory::s_arena);
+            nstring::data_t*     data = (nstring::data_t*)(v + 1);
+            data->m_ptr               = (ucs2::prune)(data + 1);
+            data->m_head              = nullptr;
+            data->m_index             = nullptr;
+            data->m_log               = nullptr;
+            data->m_arena             = nstring_memory::s_arena;
+            data->m_pieces            = nullptr;
+            data->m_len               = strlen;
+            data->m_cap               = c_sso_max_len;
+            data->m_ref               = 0;
+            data->m_flags             = c_data_embedded;
+            data->m_lock              = 0;
+            data->m_ptr[strlen]       = '\0';
+
+            v->m_range = {0, strlen};
+            v->m_data  = data->attach();
+            v->m_arena = data->m_arena;
+            v->m_slot  = -1;
+            v->m_gen   = 0;
+            data->addToList(v);
+            return v;
+        }
+
+        // Allocate a new string holding the UTF-8 in @str[0, @len), it is sized by the number of runes of
+        // valid UTF-8 so the runes are decoded straight into it. Malformed input decodes to more runes and
+        // only then the string grows.
+        static nstring::instance_t* s_alloc_utf8(const char* str, s32 len)
+        {
+            if (len <= 0)
+                return s_get_default_instance();
+
+            utf8::pcrune const   src  = (utf8::pcrune)str;
+            nstring::instance_t* v    = s_alloc_string((s32)ucs2_length(src, 0, (u32)len));
+            nstring::data_t*     data = v->m_data;
+            u32                  from = 0;
+            u32                  to   = 0;
+            ToUcs2(src, from, (u32)len, data->m_ptr, to, (u32)data->m_cap);
+            while (from < (u32)len)
+            {
+                data->m_len = (s32)to;
+                s_resize_data(data, (s32)(to + ((u32)len - from)));
+                ToUcs2(src, from, (u32)len, data->m_ptr, to, (u32)data->m_cap);
+            }
+            data->m_len       = (s32)to;
+            data->m_ptr[to]   = '\0';
+            v->m_range.m_from = 0;
+            v->m_range.m_to   = (s32)to;
             return v;
         }
 
@@ -240,389 +726,2850 @@ namespace ncore
             return true;
         }
 
-        static void s_insert_space(ucs2::prune str, s32 strlen, s32 pos, s32 len)
+        static void s_insert_space(nstring::data_t* data, s32 pos, s32 len)
         {
-            // insert space, need to start at the end to avoid overwriting
-            ucs2::rune const* src = str + strlen;
-            ucs2::rune*       dst = str + strlen + len;
-            ucs2::rune const* end = str + pos;
-            while (src > end)
-            {
-                *(--dst) = *(--src);
-            }
+            ASSERT(pos >= 0 && pos <= data->m_len);
+            s_resize_data(data, data->m_len + len);
+            ucs2::prune str = data->m_ptr;
+            nmem::memmove(str + pos + len, str + pos, (data->m_len - pos) * sizeof(ucs2::rune));
+            data->m_len += len;
+            str[data->m_len] = '\0';
         }
 
-        static void s_remove_space(ucs2::prune str, s32 strlen, s32 pos, s32 len)
+        static void s_remove_space(nstring::data_t* data, s32 pos, s32 len)
         {
-            ucs2::prune  dst = str + pos;
-            ucs2::pcrune src = dst + len;
-            ucs2::pcrune end = str + strlen;
-            while (src < end)
-                *dst++ = *src++;
-            *dst = '\0';
+            ASSERT(pos >= 0 && (pos + len) <= data->m_len);
+            ucs2::prune str = data->m_ptr;
+            nmem::memmove(str + pos, str + pos + len, (data->m_len - (pos + len)) * sizeof(ucs2::rune));
+            data->m_len -= len;
+            str[data->m_len] = '\0';
         }
 
-        // forward declare
-        static void s_adjust_active_views(nstring::instance_t* list, s32 op_code, s32 op_range_from, s32 op_range_to);
+        // An edit that would move a tail of at least c_pieces_min_len runes does not move it, instead the data
+        // is turned into a piece table: the runes are a sequence of pieces pointing into the original runes or
+        // into chunks holding the inserted runes. The pieces are the nodes of a treap ordered by position, each
+        // node counts the runes below it so that finding, cutting and joining pieces at a position is O(log n)
+        // however many edits were made. The runes are read where they are (see s_data_run), only the readers
+        // that need them in one block make them contiguous again (flatten).
+        static const s32 c_pieces_min_len   = 32 * 1024;  // minimum number of runes to move before an edit uses a piece table
+        static const s32 c_pieces_chunk_len = 4096;       // minimum number of runes in a chunk of inserted runes
 
-        static const s32 REMOVAL   = 0;
-        static const s32 INSERTION = 1;
-        static const s32 CLEARED   = 2;
-        static const s32 RELEASED  = 3;
+        struct piece_t  // 40 bytes, allocated like instance_t and data_t
+        {
+            piece_t*     m_left;   // the pieces before this one
+            piece_t*     m_right;  // the pieces after this one
+            ucs2::pcrune m_ptr;
+            s32          m_len;
+            s32          m_sum;   // number of runes of this piece and the pieces below it
+            u32          m_prio;  // random, a piece has a higher priority than the pieces below it
+        };
 
-        static void s_string_insert(nstring::instance_t* item, nstring::range_t selection, nstring::instance_t const* insert)
+        struct piece_chunk_t
         {
-            s32 const insertionLength = insert->size();
-            if (insertionLength == 0)
-                return;
+            piece_chunk_t* m_next;
+            s32            m_len;  // the runes follow this header
+            s32            m_cap;
 
-            s32 const selectionLength = selection.size();
-            s32       insertionPos    = selection.m_from;
-            if (selectionLength < insertionLength)
-            {
-                // The string to insert is larger than the selection, so we have to insert some
-                // space into the string.
-                s_resize_data(item->m_data, item->m_data->m_len + (insertionLength - selectionLength));
-                s_insert_space(item->m_data->m_ptr, item->m_data->m_len, insertionPos, insertionLength - selectionLength);
-                s_adjust_active_views(item, INSERTION, insertionPos, insertionPos + insertionLength - selectionLength);
-            }
-            else if (selectionLength > insertionLength)
+            inline ucs2::prune runes() { return (ucs2::prune)(this + 1); }
+        };
+
+        struct piece_table_t
+        {
+            piece_chunk_t* m_chunks;  // the chunk in front is the one being appended to
+            piece_t*       m_root;    // nullptr when all the runes were removed
+            u32            m_seed;    // xorshift state for the priority of a new piece
+        };
+
+        static inline s32  s_pieces_sum(piece_t const* p) { return p != nullptr ? p->m_sum : 0; }
+        static inline void s_pieces_update(piece_t* p) { p->m_sum = s_pieces_sum(p->m_left) + p->m_len + s_pieces_sum(p->m_right); }
+
+        static piece_t* s_pieces_alloc(nstring::data_t* data, ucs2::pcrune ptr, s32 len)
+        {
+            piece_table_t* table = data->m_pieces;
+            u32            seed  = table->m_seed;
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            table->m_seed = seed;
+
+            piece_t* p = (piece_t*)nstring_memory::s_alloc_object(sizeof(piece_t), data->m_arena);
+            p->m_left  = nullptr;
+            p->m_right = nullptr;
+            p->m_ptr   = ptr;
+            p->m_len   = len;
+            p->m_sum   = len;
+            p->m_prio  = seed;
+            return p;
+        }
+
+        static void s_pieces_free(piece_t* p)
+        {
+            while (p != nullptr)
             {
-                // The string to insert is smaller than the selection, so we have to remove some
-                // space from the string.
-                s_remove_space(item->m_data->m_ptr, item->m_data->m_len, insertionPos, selectionLength - insertionLength);
-                s_adjust_active_views(item, REMOVAL, insertionPos, insertionPos + selectionLength - insertionLength);
+                s_pieces_free(p->m_left);
+                piece_t* right = p->m_right;
+                nstring_memory::s_free_object(p, false);
+                p = right;
             }
-            else
+        }
+
+        static void s_pieces_release(nstring::data_t* data)
+        {
+            piece_table_t* table = data->m_pieces;
+            if (!s_in_arena(data))
+                s_pieces_free(table->m_root);
+            while (table->m_chunks != nullptr)
             {
-                // The string to insert is the same size as the selection, so we can just replace the
-                // selection with the new string.
+                piece_chunk_t* chunk = table->m_chunks;
+                table->m_chunks      = chunk->m_next;
+                nstring_memory::s_free_runes(chunk, s_in_arena(data));
             }
-
-            //s32          src         = 0;
-            ucs2::pcrune insert_data = insert->m_data->m_ptr + insert->m_range.m_from;
-            ucs2::pcrune insert_end  = insert_data + insertionLength;
-            ucs2::prune  str_data    = item->m_data->m_ptr + item->m_range.m_from + insertionPos;
-            while (insert_data < insert_end)
-                *str_data++ = *insert_data++;
+            nstring_memory::s_free_runes(table, s_in_arena(data));
+            data->m_pieces = nullptr;
+            data->m_flags &= ~c_data_pieces;
         }
 
-        static void string_remove(nstring::instance_t* str, nstring::range_t selection)
+        // Join the pieces of @l followed by the pieces of @r
+        static piece_t* s_pieces_merge(piece_t* l, piece_t* r)
         {
-            if (selection.is_empty())
-                return;
+            if (l == nullptr)
+                return r;
+            if (r == nullptr)
+                return l;
+            if (l->m_prio >= r->m_prio)
             {
-                //@TODO: it should be better to get an actual full view from the list of strings, currently we
-                //       take the easy way and just take the whole allocated size as the full
-                s_remove_space(str->m_data->m_ptr, str->m_data->m_len, selection.m_from, selection.size());
-
-                // TODO: Decision to shrink the allocated memory of m_runes ?
-                s_adjust_active_views(str, REMOVAL, selection.m_from, selection.m_to);
+                l->m_right = s_pieces_merge(l->m_right, r);
+                s_pieces_update(l);
+                return l;
             }
+            r->m_left = s_pieces_merge(l, r->m_left);
+            s_pieces_update(r);
+            return r;
         }
 
-        static nstring::range_t s_find(nstring::instance_t* str, const nstring::instance_t* find)
+        // Cut the pieces of @p into the first @pos runes @l and the rest @r, a piece holding both sides is cut in two
+        static void s_pieces_split(nstring::data_t* data, piece_t* p, s32 pos, piece_t*& l, piece_t*& r)
         {
-            if (find->is_empty() == false)
+            if (p == nullptr)
             {
-                s32 const   strsize  = str->m_range.size();
-                s32 const   findsize = find->m_range.size();
-                ucs2::prune strdata  = str->m_data->m_ptr + str->m_range.m_from;
-                ucs2::prune finddata = find->m_data->m_ptr + find->m_range.m_from;
+                l = r = nullptr;
+                return;
+            }
 
-                s32 i = 0;
-                while (i < strsize)
-                {
-                    if (strdata[i] == finddata[0])
-                    {
-                        s32 j = 1;
-                        while (j < findsize)
-                        {
-                            if (strdata[i + j] != finddata[j])
-                                goto continue_search;
-                            j++;
-                        }
-                        return {i, i + findsize};
-                    }
-                continue_search:
-                    i++;
-                }
+            s32 const left = s_pieces_sum(p->m_left);
+            if (pos <= left)
+            {
+                s_pieces_split(data, p->m_left, pos, l, p->m_left);
+                s_pieces_update(p);
+                r = p;
+            }
+            else if (pos >= left + p->m_len)
+            {
+                s_pieces_split(data, p->m_right, pos - (left + p->m_len), p->m_right, r);
+                s_pieces_update(p);
+                l = p;
+            }
+            else
+            {
+                s32 const cut  = pos - left;
+                piece_t*  tail = s_pieces_alloc(data, p->m_ptr + cut, p->m_len - cut);
+                r              = s_pieces_merge(tail, p->m_right);
+                p->m_len       = cut;
+                p->m_right     = nullptr;
+                s_pieces_update(p);
+                l = p;
             }
-            return {0, 0};
         }
 
-        static bool s_find_replace(nstring::instance_t* str, const nstring::instance_t* find, const nstring::instance_t* replace)
+        // The piece holding the rune at @pos, @pos becomes the position of that rune in the piece
+        static piece_t const* s_pieces_find(piece_table_t const* table, s32& pos)
         {
-            nstring::range_t remove = s_find(str, find);
-            if (remove.is_empty() == false)
+            piece_t const* p = table->m_root;
+            while (true)
             {
-                s32 const remove_from = remove.m_from;
-                s32 const remove_len  = remove.size();
-                s32 const diff        = remove_len - replace->size();
-                if (diff > 0)  // The string to replace the selection with is smaller, so we have to remove some space from the string.
+                s32 const left = s_pieces_sum(p->m_left);
+                if (pos < left)
                 {
-                    s_remove_space(str->m_data->m_ptr, str->m_data->m_len, remove_from, diff);
-                    // TODO: Decision to shrink the allocated memory of runes ?
-                    s_adjust_active_views(str, REMOVAL, remove_from, remove_from + diff);
+                    p = p->m_left;
                 }
-                else if (diff < 0)  // The string to replace the selection with is longer, so we have to insert some space into the string.
+                else if (pos < left + p->m_len)
                 {
-                    s_resize_data(str->m_data, str->size() + (-diff));
-                    s_insert_space(str->m_data->m_ptr, str->m_data->m_len, remove_from, -diff);
-                    s_adjust_active_views(str, INSERTION, remove_from, remove_from + -diff);
+                    pos -= left;
+                    return p;
                 }
-
-                // Copy string 'remove' into the (now) same size selection space
-                s32          src          = 0;
-                s32          dst          = remove_from;
-                //s32 const    end          = remove_from + replace->size();
-                ucs2::prune  pdst         = str->m_data->m_ptr;
-                ucs2::pcrune replace_data = replace->m_data->m_ptr + replace->m_range.m_from;
-                while (src < replace->size())
+                else
                 {
-                    pdst[dst++] = replace_data[src++];
+                    pos -= left + p->m_len;
+                    p = p->m_right;
                 }
-                return true;
-            }
-            return false;
-        }
-
-        static bool s_contains(const uchar16* str, s32 strLen, uchar32 find)
-        {
-            uchar16 const* strData = str;
-            uchar16 const* strEnd  = str + strLen;
-            while (strData < strEnd)
-            {
-                uchar32 const c = *strData++;
-                if (c == find)
-                    return true;
             }
-            return false;
         }
 
-        static void s_remove_any(nstring::instance_t* str, const uchar16* any, s32 any_count)
+        // Call @visit with every piece and its position in order, or in reverse order
+        template <bool reverse, typename V> static void s_pieces_visit(piece_t const* p, s32 pos, V const& visit)
         {
-            // Remove any of the characters in @charset from @str
-            s32 const strfrom = str->m_range.m_from;
-            //s32 const strto   = str->m_range.m_to;
-            s32 const strsize = str->m_range.m_to - str->m_range.m_from;
-
-            s32         d       = 0;
-            s32         i       = 0;
-            s32         r       = -1;
-            ucs2::prune strdata = str->m_data->m_ptr + strfrom;
-            while (i < strsize)
+            while (p != nullptr)
             {
-                uchar32 const c = strdata[i];
-                if (s_contains(any, any_count, c))
+                s32 const at = pos + s_pieces_sum(p->m_left);
+                if (reverse)
                 {
-                    if (r == -1)
-                        r = i;
-                    i++;
+                    s_pieces_visit<reverse>(p->m_right, at + p->m_len, visit);
+                    visit(p, at);
+                    p = p->m_left;
                 }
                 else
                 {
-                    if (r >= 0)
-                    {
-                        // This might not be the first character(s)/range removed, if not then the views already
-                        // have been adjusted according to the previous range removal. So here we have to adjust
-                        // this removal range by shifting it left with 'gap'.
-                        s32 const gap = r - d;
-                        s_adjust_active_views(str, REMOVAL, r - gap, i - gap);
-                        r = -1;
-                    }
-
-                    if (i > d)
-                    {
-                        strdata[d] = c;
-                    }
-                    i++;
-                    d++;
+                    s_pieces_visit<reverse>(p->m_left, pos, visit);
+                    visit(p, at);
+                    pos = at + p->m_len;
+                    p   = p->m_right;
                 }
             }
+        }
+
+        // Moves the pieces of the original runes at @m_ptr that move left (pass 0) or right (pass 1) to their
+        // place, pass 2 copies the inserted runes
+        struct flatten_piece_t
+        {
+            ucs2::prune  m_ptr;
+            ucs2::pcrune m_end;
+            s32          m_pass;
 
-            s32 const l = i - d;
-            if (l > 0)
+            void operator()(piece_t const* piece, s32 pos) const
             {
-                // We still need to move the rest of the string that is not in this view but is part of
-                // of the full string.
-                ucs2::prune strdata = str->m_data->m_ptr + strfrom;
-                while (i < str->m_data->m_len)
-                {
-                    uchar32 const c = strdata[i];
-                    strdata[d]      = c;
-                    i++;
-                    d++;
-                }
+                bool const        original = piece->m_ptr >= m_ptr && piece->m_ptr < m_end;
+                ucs2::prune const dst      = m_ptr + pos;
+                if (m_pass == 2 ? !original : (original && (m_pass == 0) == (dst <= piece->m_ptr)))
+                    nmem::memmove(dst, piece->m_ptr, piece->m_len * sizeof(ucs2::rune));
+            }
+        };
 
-                str->m_data->m_len -= l;
-                ucs2::prune pdst         = (ucs2::prune)str->m_data->m_ptr;
-                pdst[str->m_data->m_len] = '\0';
+        // Write the pieces back into the runes of @data and release the piece table. The pieces that point
+        // into the original runes keep their order, so when they fit they are moved in place: first the ones
+        // moving left from left to right, then the ones moving right from right to left, and last the
+        // inserted runes are copied. Otherwise the pieces are copied into a new allocation.
+        static void s_pieces_flatten(nstring::data_t* data)
+        {
+            piece_t const* root = data->m_pieces->m_root;
+            if (data->m_len <= data->m_cap)
+            {
+                ucs2::prune const     ptr    = data->m_ptr;
+                flatten_piece_t const left   = {ptr, ptr + data->m_cap, 0};
+                flatten_piece_t const right  = {ptr, ptr + data->m_cap, 1};
+                flatten_piece_t const insert = {ptr, ptr + data->m_cap, 2};
+                s_pieces_visit<false>(root, 0, left);
+                s_pieces_visit<true>(root, 0, right);
+                s_pieces_visit<false>(root, 0, insert);
+                ptr[data->m_len] = '\0';
+                s_pieces_release(data);
+                return;
             }
+
+            s32 const   cap = data->m_len + (data->m_len >> 1);
+            ucs2::prune const     ptr  = (ucs2::prune)nstring_memory::s_alloc_runes((cap + 1) * sizeof(ucs2::rune), data->m_arena);
+            flatten_piece_t const copy = {ptr, ptr, 2};  // none of the pieces point into the new runes
+            s_pieces_visit<false>(root, 0, copy);
+            ptr[data->m_len] = '\0';
+
+            s_pieces_release(data);
+            nstring_memory::s_free_runes(data->m_ptr, s_in_arena(data));
+            data->m_ptr = ptr;
+            data->m_cap = cap;
         }
 
-        static const s32 NONE     = 0;
-        static const s32 LEFT     = 0x0800;  // binary(0000,1000,0000,0000);
+        // A string that is edited again before its runes are read keeps a gap at the position of the last
+        // edit, an edit close to the previous one then only moves the runes in between. The gap takes all
+        // of the unused runes at the end of the allocation, flattening the runes moves it back to the end.
+        static const s32 c_gap_min_len = 1024;  // minimum number of runes to move before an edit opens a gap
+
+        // Move the gap to @pos, remove the @remove runes after it and write the @count runes of @insert
+        static void s_gap_replace(nstring::data_t* data, s32 pos, s32 remove, ucs2::pcrune insert, s32 count)
+        {
+            ucs2::prune ptr = data->m_ptr;
+            s32         gap = data->m_cap - data->m_len;
+            if (pos < data->m_gap)
+                nmem::memmove(ptr + pos + gap, ptr + pos, (data->m_gap - pos) * sizeof(ucs2::rune));
+            else if (pos > data->m_gap)
+                nmem::memmove(ptr + data->m_gap, ptr + data->m_gap + gap, (pos - data->m_gap) * sizeof(ucs2::rune));
+            data->m_gap = pos;
+            data->m_len -= remove;
+            gap += remove;
+
+            if (gap < count)
+            {
+                // Grow like s_resize_data, the runes after the gap move to the end of the new allocation
+                s32 const tail = data->m_len - pos;
+                s32       cap  = data->m_cap + (data->m_cap >> 1);
+                if (cap < data->m_len + count)
+                    cap = data->m_len + count;
+                ucs2::prune newptr = (ucs2::prune)nstring_memory::s_alloc_runes((cap + 1) * sizeof(ucs2::rune), data->m_arena);
+                nmem::memcpy(newptr, ptr, pos * sizeof(ucs2::rune));
+                nmem::memcpy(newptr + cap - tail, ptr + pos + gap, tail * sizeof(ucs2::rune));
+                nstring_memory::s_free_runes(ptr, s_in_arena(data));
+                ptr         = newptr;
+                data->m_ptr = newptr;
+                data->m_cap = cap;
+            }
+
+            if (count > 0)
+                nmem::memcpy(ptr + pos, insert, count * sizeof(ucs2::rune));
+            data->m_gap += count;
+            data->m_len += count;
+        }
+
+        // Move the gap of @data to the end so that the runes are contiguous
+        static void s_gap_close(nstring::data_t* data)
+        {
+            ucs2::prune ptr = data->m_ptr;
+            nmem::memmove(ptr + data->m_gap, ptr + data->m_gap + (data->m_cap - data->m_len), (data->m_len - data->m_gap) * sizeof(ucs2::rune));
+            ptr[data->m_len] = '\0';
+        }
+
+        // Make the runes of @data contiguous, this is done before they are read
+        static void s_flatten(nstring::data_t* data)
+        {
+            // Readers in different threads may find the same data to flatten, the first one does it
+            natomic::scoped_lock_t lock(&data->m_lock);
+            if ((data->m_flags & c_data_pieces) != 0)
+                s_pieces_flatten(data);
+            else if ((data->m_flags & c_data_gap) != 0)
+                s_gap_close(data);
+            natomic::store(&data->m_flags, (u16)(data->m_flags & ~c_data_flatten));
+        }
+
+        // How an edit at @pos is applied to the runes of @data, a piece table or a gap is created when needed
+        static const s32 c_edit_move   = 0;  // the runes after the edit are moved
+        static const s32 c_edit_gap    = 1;
+        static const s32 c_edit_pieces = 2;
+
+        static s32 s_edit_mode(nstring::data_t* data, s32 pos)
+        {
+            ASSERT((data->m_flags & c_data_hashed) == 0);  // see s_make_writable()
+            if ((data->m_flags & c_data_pieces) != 0)
+                return c_edit_pieces;
+            if ((data->m_flags & c_data_gap) != 0)
+                return c_edit_gap;
+
+            // The embedded data of a small string that grew is moved around by share(), keep it contiguous
+            s32 const tail = data->m_len - pos;
+            if (tail >= c_pieces_min_len && !data->is_embedded())
+            {
+                piece_table_t* table = (piece_table_t*)nstring_memory::s_alloc_runes(sizeof(piece_table_t), data->m_arena);
+                table->m_chunks      = nullptr;
+                table->m_root        = nullptr;
+                table->m_seed        = 0x9e3779b9u;
+                data->m_pieces       = table;
+                table->m_root        = s_pieces_alloc(data, data->m_ptr, data->m_len);
+                data->m_flags |= c_data_pieces;
+                return c_edit_pieces;
+            }
+            if (tail >= c_gap_min_len && !data->is_embedded() && (data->m_flags & c_data_edited) != 0)
+            {
+                data->m_gap = data->m_len;
+                data->m_flags |= c_data_gap;
+                return c_edit_gap;
+            }
+            data->m_flags |= c_data_edited;
+            return c_edit_move;
+        }
+
+        // Replace the @remove runes at @pos with the @count runes of @insert
+        static void s_pieces_replace(nstring::data_t* data, s32 pos, s32 remove, ucs2::pcrune insert, s32 count)
+        {
+            piece_table_t* table = data->m_pieces;
+
+            // Copy the runes to insert first, they may be part of the data
+            ucs2::prune runes = nullptr;
+            if (count > 0)
+            {
+                piece_chunk_t* chunk = table->m_chunks;
+                if (chunk == nullptr || (chunk->m_cap - chunk->m_len) < count)
+                {
+                    s32 const cap   = count > c_pieces_chunk_len ? count : c_pieces_chunk_len;
+                    chunk           = (piece_chunk_t*)nstring_memory::s_alloc_runes(sizeof(piece_chunk_t) + cap * sizeof(ucs2::rune), data->m_arena);
+                    chunk->m_next   = table->m_chunks;
+                    chunk->m_len    = 0;
+                    chunk->m_cap    = cap;
+                    table->m_chunks = chunk;
+                }
+                runes = chunk->runes() + chunk->m_len;
+                nmem::memcpy(runes, insert, count * sizeof(ucs2::rune));
+                chunk->m_len += count;
+            }
+
+            piece_t* before;
+            piece_t* after;
+            s_pieces_split(data, table->m_root, pos, before, after);
+            if (remove > 0)
+            {
+                piece_t* removed;
+                s_pieces_split(data, after, remove, removed, after);
+                if (!s_in_arena(data))
+                    s_pieces_free(removed);
+            }
+
+            if (count > 0)
+            {
+                // Typing appends to the chunk right after the previously inserted runes, extend that piece
+                piece_t* last = before;
+                while (last != nullptr && last->m_right != nullptr)
+                    last = last->m_right;
+                if (last != nullptr && (last->m_ptr + last->m_len) == runes)
+                {
+                    for (piece_t* p = before; p != nullptr; p = p->m_right)
+                        p->m_sum += count;
+                    last->m_len += count;
+                }
+                else
+                {
+                    before = s_pieces_merge(before, s_pieces_alloc(data, runes, count));
+                }
+            }
+
+            table->m_root = s_pieces_merge(before, after);
+            data->m_len += count - remove;
+        }
+
+        // A run of runes of @data that are contiguous, the rune at position m_from of the data is at m_ptr
+        struct run_t
+        {
+            ucs2::pcrune m_ptr;
+            s32          m_from;
+            s32          m_to;
+        };
+
+        // The run holding the rune at @pos of @data, runes that are not contiguous are read under the lock of
+        // the data (see read_lock_t) since a reader in another thread may flatten them (see s_flatten)
+        static run_t s_data_run(nstring::data_t const* data, s32 pos)
+        {
+            ASSERT(pos >= 0 && pos < data->m_len);
+            if ((data->m_flags & c_data_pieces) != 0)
+            {
+                s32            offset = pos;
+                piece_t const* piece  = s_pieces_find(data->m_pieces, offset);
+                return {piece->m_ptr, pos - offset, pos - offset + piece->m_len};
+            }
+            if ((data->m_flags & c_data_gap) != 0 && pos >= data->m_gap)
+                return {data->m_ptr + data->m_gap + (data->m_cap - data->m_len), data->m_gap, data->m_len};
+            if ((data->m_flags & c_data_gap) != 0)
+                return {data->m_ptr, 0, data->m_gap};
+            return {data->m_ptr, 0, data->m_len};
+        }
+
+        static inline bool s_data_is_contiguous(nstring::data_t const* data) { return (natomic::load(&data->m_flags) & (c_data_gap | c_data_pieces)) == 0; }
+
+        // Holds the lock of the data that is read while its runes are not contiguous, the data of two strings
+        // is locked in address order
+        class read_lock_t
+        {
+        public:
+            read_lock_t(nstring::data_t* a, nstring::data_t* b = nullptr)
+                : m_a(nullptr)
+                , m_b(nullptr)
+            {
+                if (b != nullptr && b != a && !s_data_is_contiguous(b))
+                    m_b = b;
+                if (!s_data_is_contiguous(a))
+                    m_a = a;
+                if (m_a != nullptr && m_b != nullptr && m_b < m_a)
+                {
+                    m_a = m_b;
+                    m_b = a;
+                }
+                if (m_a != nullptr)
+                    natomic::lock(&m_a->m_lock);
+                if (m_b != nullptr)
+                    natomic::lock(&m_b->m_lock);
+            }
+
+            ~read_lock_t()
+            {
+                if (m_b != nullptr)
+                    natomic::unlock(&m_b->m_lock);
+                if (m_a != nullptr)
+                    natomic::unlock(&m_a->m_lock);
+            }
+
+        private:
+            nstring::data_t* m_a;
+            nstring::data_t* m_b;
+        };
+
+        // The rune at @pos of @data without flattening it
+        static ucs2::rune s_data_rune(nstring::data_t* data, s32 pos)
+        {
+            if (s_data_is_contiguous(data))
+                return data->m_ptr[pos];
+
+            read_lock_t const lock(data);
+            run_t const       run = s_data_run(data, pos);
+            return run.m_ptr[pos - run.m_from];
+        }
+
+        // Copy the runes [@from, @to) of @data to @dst
+        static void s_data_copy(nstring::data_t const* data, s32 from, s32 to, ucs2::prune dst)
+        {
+            while (from < to)
+            {
+                run_t const run = s_data_run(data, from);
+                s32 const   end = math::min(run.m_to, to);
+                nmem::memcpy(dst, run.m_ptr + (from - run.m_from), (end - from) * sizeof(ucs2::rune));
+                dst += end - from;
+                from = end;
+            }
+        }
+
+        // forward declare
+        static void s_adjust_active_views(nstring::instance_t* list, s32 op_code, s32 op_range_from, s32 op_range_to);
+        static void s_park_views(nstring::instance_t* str, s32 active);
+        static void s_log_flush(nstring::data_t* data);
+        template <typename V> static void s_index_edit(nstring::data_t* data, s32 from, s32 to, s32 shift, V const& visit);
+
+        static const s32 REMOVAL   = 0;
+        static const s32 INSERTION = 1;
+        static const s32 CLEARED   = 2;
+        static const s32 RELEASED  = 3;
+
+        static void s_string_insert(nstring::instance_t* item, nstring::range_t selection, nstring::instance_t const* insert)
+        {
+            s32 const insertionLength = insert->size();
+            if (insertionLength == 0)
+                return;
+
+            s32 const selectionLength = selection.size();
+            s32       insertionPos    = selection.m_from;
+            s32 const mode            = s_edit_mode(item->m_data, insertionPos);
+            if (mode != c_edit_move)
+            {
+                ucs2::pcrune const runes = insert->m_data->m_ptr + insert->m_range.m_from;
+                if (mode == c_edit_pieces)
+                    s_pieces_replace(item->m_data, insertionPos, selectionLength, runes, insertionLength);
+                else
+                    s_gap_replace(item->m_data, insertionPos, selectionLength, runes, insertionLength);
+                if (selectionLength < insertionLength)
+                    s_adjust_active_views(item, INSERTION, insertionPos, insertionPos + insertionLength - selectionLength);
+                else if (selectionLength > insertionLength)
+                    s_adjust_active_views(item, REMOVAL, insertionPos, insertionPos + selectionLength - insertionLength);
+                return;
+            }
+
+            if (selectionLength < insertionLength)
+            {
+                // The string to insert is larger than the selection, so we have to insert some
+                // space into the string.
+                s_insert_space(item->m_data, insertionPos, insertionLength - selectionLength);
+                s_adjust_active_views(item, INSERTION, insertionPos, insertionPos + insertionLength - selectionLength);
+            }
+            else if (selectionLength > insertionLength)
+            {
+                // The string to insert is smaller than the selection, so we have to remove some
+                // space from the string.
+                s_remove_space(item->m_data, insertionPos, selectionLength - insertionLength);
+                s_adjust_active_views(item, REMOVAL, insertionPos, insertionPos + selectionLength - insertionLength);
+            }
+            else
+            {
+                // The string to insert is the same size as the selection, so we can just replace the
+                // selection with the new string.
+            }
+
+            //s32          src         = 0;
+            ucs2::pcrune insert_data = insert->m_data->m_ptr + insert->m_range.m_from;
+            ucs2::pcrune insert_end  = insert_data + insertionLength;
+            ucs2::prune  str_data    = item->m_data->m_ptr + insertionPos;
+            while (insert_data < insert_end)
+                *str_data++ = *insert_data++;
+        }
+
+        static void string_remove(nstring::instance_t* str, nstring::range_t selection)
+        {
+            if (selection.is_empty())
+                return;
+            {
+                //@TODO: it should be better to get an actual full view from the list of strings, currently we
+                //       take the easy way and just take the whole allocated size as the full
+                s32 const mode = s_edit_mode(str->m_data, selection.m_from);
+                if (mode == c_edit_pieces)
+                    s_pieces_replace(str->m_data, selection.m_from, selection.size(), nullptr, 0);
+                else if (mode == c_edit_gap)
+                    s_gap_replace(str->m_data, selection.m_from, selection.size(), nullptr, 0);
+                else
+                    s_remove_space(str->m_data, selection.m_from, selection.size());
+
+                // TODO: Decision to shrink the allocated memory of m_runes ?
+                s_adjust_active_views(str, REMOVAL, selection.m_from, selection.m_to);
+            }
+        }
+
+        // Insert @count runes of space at the end of the view @item and extend the view to cover
+        // them, returns the location where the appended runes should be written.
+        static ucs2::prune s_append_space(nstring::instance_t* item, s32 count)
+        {
+            s32 const pos = item->m_range.m_to;
+            if (pos < item->m_data->m_len)
+            {
+                s_insert_space(item->m_data, pos, count);
+                s_adjust_active_views(item, INSERTION, pos, pos + count);
+            }
+            else
+            {
+                s_insert_space(item->m_data, pos, count);
+            }
+            item->m_range.m_to += count;
+            return item->m_data->m_ptr + pos;
+        }
+
+        //------------------------------------------------------------------------------
+        //------------ search ----------------------------------------------------------
+        //------------------------------------------------------------------------------
+        // Substring search on UCS-2 runes, these return the index of the first (or last) occurrence
+        // of @find in @str or -1 when it is not found. The SIMD versions compare the first and last rune
+        // of @find against 8 (SSE2/NEON) or 16 (AVX2) positions at once and only verify the candidates.
+        typedef s32 (*find_runes_fn)(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen);
+
+        static inline bool s_equal_runes(ucs2::pcrune a, ucs2::pcrune b, s32 len) { return len <= 0 || nmem::memcmp(a, b, len * sizeof(ucs2::rune)) == 0; }
+
+        static s32 s_find_runes_scalar(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            ucs2::rune const first = find[0];
+            for (s32 i = 0; i <= (strlen - findlen); ++i)
+            {
+                if (str[i] == first && s_equal_runes(str + i + 1, find + 1, findlen - 1))
+                    return i;
+            }
+            return -1;
+        }
+
+        static s32 s_find_last_runes_scalar(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            ucs2::rune const first = find[0];
+            for (s32 i = strlen - findlen; i >= 0; --i)
+            {
+                if (str[i] == first && s_equal_runes(str + i + 1, find + 1, findlen - 1))
+                    return i;
+            }
+            return -1;
+        }
+
+#if defined(CSTRING_SIMD_SSE2)
+        static s32 s_find_runes_sse2(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            __m128i const first = _mm_set1_epi16((short)find[0]);
+            __m128i const last  = _mm_set1_epi16((short)find[findlen - 1]);
+            s32           i     = 0;
+            for (; (i + findlen - 1 + 8) <= strlen; i += 8)
+            {
+                __m128i const bf   = _mm_loadu_si128((__m128i const*)(str + i));
+                __m128i const bl   = _mm_loadu_si128((__m128i const*)(str + i + findlen - 1));
+                u32           mask = (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(first, bf), _mm_cmpeq_epi16(last, bl)));
+                while (mask != 0)
+                {
+                    s32 const lane = nsimd::ctz32(mask) >> 1;
+                    if (s_equal_runes(str + i + lane + 1, find + 1, findlen - 2))
+                        return i + lane;
+                    mask &= ~(3u << (lane * 2));
+                }
+            }
+            s32 const r = s_find_runes_scalar(str + i, strlen - i, find, findlen);
+            return r < 0 ? -1 : i + r;
+        }
+
+        static s32 s_find_last_runes_sse2(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            __m128i const first = _mm_set1_epi16((short)find[0]);
+            __m128i const last  = _mm_set1_epi16((short)find[findlen - 1]);
+            s32           hi    = strlen - findlen;  // the last candidate position
+            for (; hi >= 7; hi -= 8)
+            {
+                s32 const     i    = hi - 7;
+                __m128i const bf   = _mm_loadu_si128((__m128i const*)(str + i));
+                __m128i const bl   = _mm_loadu_si128((__m128i const*)(str + i + findlen - 1));
+                u32           mask = (u32)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(first, bf), _mm_cmpeq_epi16(last, bl)));
+                while (mask != 0)
+                {
+                    s32 const lane = nsimd::msb32(mask) >> 1;
+                    if (s_equal_runes(str + i + lane + 1, find + 1, findlen - 2))
+                        return i + lane;
+                    mask &= ~(3u << (lane * 2));
+                }
+            }
+            return s_find_last_runes_scalar(str, hi + findlen, find, findlen);
+        }
+
+        CSTRING_TARGET_AVX2 static s32 s_find_runes_avx2(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            __m256i const first = _mm256_set1_epi16((short)find[0]);
+            __m256i const last  = _mm256_set1_epi16((short)find[findlen - 1]);
+            s32           i     = 0;
+            for (; (i + findlen - 1 + 16) <= strlen; i += 16)
+            {
+                __m256i const bf   = _mm256_loadu_si256((__m256i const*)(str + i));
+                __m256i const bl   = _mm256_loadu_si256((__m256i const*)(str + i + findlen - 1));
+                u32           mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi16(first, bf), _mm256_cmpeq_epi16(last, bl)));
+                while (mask != 0)
+                {
+                    s32 const lane = nsimd::ctz32(mask) >> 1;
+                    if (s_equal_runes(str + i + lane + 1, find + 1, findlen - 2))
+                        return i + lane;
+                    mask &= ~(3u << (lane * 2));
+                }
+            }
+            s32 const r = s_find_runes_sse2(str + i, strlen - i, find, findlen);
+            return r < 0 ? -1 : i + r;
+        }
+
+        CSTRING_TARGET_AVX2 static s32 s_find_last_runes_avx2(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            __m256i const first = _mm256_set1_epi16((short)find[0]);
+            __m256i const last  = _mm256_set1_epi16((short)find[findlen - 1]);
+            s32           hi    = strlen - findlen;
+            for (; hi >= 15; hi -= 16)
+            {
+                s32 const     i    = hi - 15;
+                __m256i const bf   = _mm256_loadu_si256((__m256i const*)(str + i));
+                __m256i const bl   = _mm256_loadu_si256((__m256i const*)(str + i + findlen - 1));
+                u32           mask = (u32)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi16(first, bf), _mm256_cmpeq_epi16(last, bl)));
+                while (mask != 0)
+                {
+                    s32 const lane = nsimd::msb32(mask) >> 1;
+                    if (s_equal_runes(str + i + lane + 1, find + 1, findlen - 2))
+                        return i + lane;
+                    mask &= ~(3u << (lane * 2));
+                }
+            }
+            return s_find_last_runes_sse2(str, hi + findlen, find, findlen);
+        }
+#elif defined(CSTRING_SIMD_NEON)
+        // Narrow the 16-bit lane compare result to a 64-bit mask with 8 bits per lane
+        static inline u64 s_neon_mask(uint16x8_t eq) { return vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(eq)), 0); }
+
+        static s32 s_find_runes_neon(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            uint16x8_t const first = vdupq_n_u16(find[0]);
+            uint16x8_t const last  = vdupq_n_u16(find[findlen - 1]);
+            s32              i     = 0;
+            for (; (i + findlen - 1 + 8) <= strlen; i += 8)
+            {
+                uint16x8_t const bf   = vld1q_u16(str + i);
+                uint16x8_t const bl   = vld1q_u16(str + i + findlen - 1);
+                u64              mask = s_neon_mask(vandq_u16(vceqq_u16(first, bf), vceqq_u16(last, bl)));
+                while (mask != 0)
+                {
+                    s32 const lane = nsimd::ctz64(mask) >> 3;
+                    if (s_equal_runes(str + i + lane + 1, find + 1, findlen - 2))
+                        return i + lane;
+                    mask &= ~((u64)0xFF << (lane * 8));
+                }
+            }
+            s32 const r = s_find_runes_scalar(str + i, strlen - i, find, findlen);
+            return r < 0 ? -1 : i + r;
+        }
+
+        static s32 s_find_last_runes_neon(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            uint16x8_t const first = vdupq_n_u16(find[0]);
+            uint16x8_t const last  = vdupq_n_u16(find[findlen - 1]);
+            s32              hi    = strlen - findlen;
+            for (; hi >= 7; hi -= 8)
+            {
+                s32 const        i    = hi - 7;
+                uint16x8_t const bf   = vld1q_u16(str + i);
+                uint16x8_t const bl   = vld1q_u16(str + i + findlen - 1);
+                u64              mask = s_neon_mask(vandq_u16(vceqq_u16(first, bf), vceqq_u16(last, bl)));
+                while (mask != 0)
+                {
+                    s32 const lane = nsimd::msb64(mask) >> 3;
+                    if (s_equal_runes(str + i + lane + 1, find + 1, findlen - 2))
+                        return i + lane;
+                    mask &= ~((u64)0xFF << (lane * 8));
+                }
+            }
+            return s_find_last_runes_scalar(str, hi + findlen, find, findlen);
+        }
+#endif
+
+        // The implementations are selected on first use according to the features of the CPU, see CSTRING_SIMD_SELECT
+        static s32 s_find_runes_impl(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            static find_runes_fn const s_fn = CSTRING_SIMD_SELECT(s_find_runes);
+            return s_fn(str, strlen, find, findlen);
+        }
+
+        static s32 s_find_last_runes_impl(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            static find_runes_fn const s_fn = CSTRING_SIMD_SELECT(s_find_last_runes);
+            return s_fn(str, strlen, find, findlen);
+        }
+
+        // Return the index of the first rune where @a and @b differ, @len when the first @len runes are the same
+        typedef s32 (*mismatch_runes_fn)(ucs2::pcrune a, ucs2::pcrune b, s32 len);
+
+        static s32 s_mismatch_runes_scalar(ucs2::pcrune a, ucs2::pcrune b, s32 len)
+        {
+            s32 i = 0;
+            while (i < len && a[i] == b[i])
+                ++i;
+            return i;
+        }
+
+#if defined(CSTRING_SIMD_SSE2)
+        static s32 s_mismatch_runes_sse2(ucs2::pcrune a, ucs2::pcrune b, s32 len)
+        {
+            s32 i = 0;
+            for (; (i + 8) <= len; i += 8)
+            {
+                __m128i const va   = _mm_loadu_si128((__m128i const*)(a + i));
+                __m128i const vb   = _mm_loadu_si128((__m128i const*)(b + i));
+                u32 const     mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) ^ 0xFFFF;
+                if (mask != 0)
+                    return i + (nsimd::ctz32(mask) >> 1);
+            }
+            return i + s_mismatch_runes_scalar(a + i, b + i, len - i);
+        }
+
+        CSTRING_TARGET_AVX2 static s32 s_mismatch_runes_avx2(ucs2::pcrune a, ucs2::pcrune b, s32 len)
+        {
+            s32 i = 0;
+            for (; (i + 16) <= len; i += 16)
+            {
+                __m256i const va   = _mm256_loadu_si256((__m256i const*)(a + i));
+                __m256i const vb   = _mm256_loadu_si256((__m256i const*)(b + i));
+                u32 const     mask = ~(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi16(va, vb));
+                if (mask != 0)
+                    return i + (nsimd::ctz32(mask) >> 1);
+            }
+            return i + s_mismatch_runes_sse2(a + i, b + i, len - i);
+        }
+#elif defined(CSTRING_SIMD_NEON)
+        static s32 s_mismatch_runes_neon(ucs2::pcrune a, ucs2::pcrune b, s32 len)
+        {
+            s32 i = 0;
+            for (; (i + 8) <= len; i += 8)
+            {
+                u64 const mask = ~s_neon_mask(vceqq_u16(vld1q_u16(a + i), vld1q_u16(b + i)));
+                if (mask != 0)
+                    return i + (nsimd::ctz64(mask) >> 3);
+            }
+            return i + s_mismatch_runes_scalar(a + i, b + i, len - i);
+        }
+#endif
+
+        static s32 s_mismatch_runes_impl(ucs2::pcrune a, ucs2::pcrune b, s32 len)
+        {
+            static mismatch_runes_fn const s_fn = CSTRING_SIMD_SELECT(s_mismatch_runes);
+            return s_fn(a, b, len);
+        }
+
+        // A class of runes (e.g. lower case letters), an ASCII rune is in the class when (rune | m_fold) is in
+        // [m_lo, m_hi], other runes are tested with m_is. The kernels test 8 or 16 ASCII runes at once, a block
+        // with any non-ASCII rune is handled one rune at a time.
+        struct rune_class_t
+        {
+            ucs2::rune m_fold;
+            ucs2::rune m_lo;
+            ucs2::rune m_hi;
+            bool (*m_is)(uchar16 c);
+        };
+
+        // The case mapping of the runes in a class, an ASCII rune in the class is mapped by adding m_delta
+        struct case_map_t
+        {
+            rune_class_t m_class;
+            s16          m_delta;
+            uchar16 (*m_map)(uchar16 c);
+        };
+
+        // The ASCII ranges agree with the BMP tables (see c_bmp.h) that handle the other runes
+        static const rune_class_t c_class_alpha = {0x20, 'a', 'z', nbmp::is_alpha};
+        static const rune_class_t c_class_upper = {0, 'A', 'Z', nbmp::is_upper};
+        static const rune_class_t c_class_lower = {0, 'a', 'z', nbmp::is_lower};
+        static const case_map_t   c_case_upper  = {c_class_lower, 'A' - 'a', nbmp::to_upper};
+        static const case_map_t   c_case_lower  = {c_class_upper, 'a' - 'A', nbmp::to_lower};
+        static const case_map_t   c_case_title  = {c_class_lower, 'A' - 'a', nbmp::to_title};
+
+        // Return the length of the leading runes of @str that are (@in is true) or are not in class @c
+        typedef s32 (*span_class_fn)(ucs2::pcrune str, s32 len, rune_class_t const& c, bool in);
+        typedef void (*map_case_fn)(ucs2::prune str, s32 len, case_map_t const& m);
+
+        static s32 s_span_class_scalar(ucs2::pcrune str, s32 len, rune_class_t const& c, bool in)
+        {
+            s32 i = 0;
+            while (i < len && c.m_is(str[i]) == in)
+                ++i;
+            return i;
+        }
+
+        static void s_map_case_scalar(ucs2::prune str, s32 len, case_map_t const& m)
+        {
+            for (s32 i = 0; i < len; ++i)
+                str[i] = m.m_map(str[i]);
+        }
+
+#if defined(CSTRING_SIMD_SSE2)
+        static inline bool s_is_ascii_sse2(__m128i v) { return _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128())) == 0xFFFF; }
+
+        // The lanes of the ASCII runes in @v that are in class @c, the compares are signed which is fine for ASCII
+        static inline __m128i s_in_class_sse2(__m128i v, rune_class_t const& c)
+        {
+            __m128i const f = _mm_or_si128(v, _mm_set1_epi16((short)c.m_fold));
+            return _mm_and_si128(_mm_cmpgt_epi16(f, _mm_set1_epi16((short)(c.m_lo - 1))), _mm_cmplt_epi16(f, _mm_set1_epi16((short)(c.m_hi + 1))));
+        }
+
+        static s32 s_span_class_sse2(ucs2::pcrune str, s32 len, rune_class_t const& c, bool in)
+        {
+            u32 const flip = in ? 0xFFFF : 0;
+            s32       i    = 0;
+            for (; (i + 8) <= len; i += 8)
+            {
+                __m128i const v = _mm_loadu_si128((__m128i const*)(str + i));
+                if (!s_is_ascii_sse2(v))
+                {
+                    s32 const n = s_span_class_scalar(str + i, 8, c, in);
+                    if (n < 8)
+                        return i + n;
+                    continue;
+                }
+                u32 const mask = (u32)_mm_movemask_epi8(s_in_class_sse2(v, c)) ^ flip;  // the lanes that end the span
+                if (mask != 0)
+                    return i + (nsimd::ctz32(mask) >> 1);
+            }
+            return i + s_span_class_scalar(str + i, len - i, c, in);
+        }
+
+        static void s_map_case_sse2(ucs2::prune str, s32 len, case_map_t const& m)
+        {
+            __m128i const delta = _mm_set1_epi16(m.m_delta);
+            s32           i     = 0;
+            for (; (i + 8) <= len; i += 8)
+            {
+                __m128i const v = _mm_loadu_si128((__m128i const*)(str + i));
+                if (!s_is_ascii_sse2(v))
+                {
+                    s_map_case_scalar(str + i, 8, m);
+                    continue;
+                }
+                _mm_storeu_si128((__m128i*)(str + i), _mm_add_epi16(v, _mm_and_si128(s_in_class_sse2(v, m.m_class), delta)));
+            }
+            s_map_case_scalar(str + i, len - i, m);
+        }
+
+        CSTRING_TARGET_AVX2 static inline bool s_is_ascii_avx2(__m256i v) { return _mm256_testz_si256(v, _mm256_set1_epi16((short)0xFF80)) != 0; }
+
+        CSTRING_TARGET_AVX2 static inline __m256i s_in_class_avx2(__m256i v, rune_class_t const& c)
+        {
+            __m256i const f = _mm256_or_si256(v, _mm256_set1_epi16((short)c.m_fold));
+            return _mm256_and_si256(_mm256_cmpgt_epi16(f, _mm256_set1_epi16((short)(c.m_lo - 1))), _mm256_cmpgt_epi16(_mm256_set1_epi16((short)(c.m_hi + 1)), f));
+        }
+
+        CSTRING_TARGET_AVX2 static s32 s_span_class_avx2(ucs2::pcrune str, s32 len, rune_class_t const& c, bool in)
+        {
+            u32 const flip = in ? 0xFFFFFFFF : 0;
+            s32       i    = 0;
+            for (; (i + 16) <= len; i += 16)
+            {
+                __m256i const v = _mm256_loadu_si256((__m256i const*)(str + i));
+                if (!s_is_ascii_avx2(v))
+                {
+                    s32 const n = s_span_class_scalar(str + i, 16, c, in);
+                    if (n < 16)
+                        return i + n;
+                    continue;
+                }
+                u32 const mask = (u32)_mm256_movemask_epi8(s_in_class_avx2(v, c)) ^ flip;
+                if (mask != 0)
+                    return i + (nsimd::ctz32(mask) >> 1);
+            }
+            return i + s_span_class_sse2(str + i, len - i, c, in);
+        }
+
+        CSTRING_TARGET_AVX2 static void s_map_case_avx2(ucs2::prune str, s32 len, case_map_t const& m)
+        {
+            __m256i const delta = _mm256_set1_epi16(m.m_delta);
+            s32           i     = 0;
+            for (; (i + 16) <= len; i += 16)
+            {
+                __m256i const v = _mm256_loadu_si256((__m256i const*)(str + i));
+                if (!s_is_ascii_avx2(v))
+                {
+                    s_map_case_scalar(str + i, 16, m);
+                    continue;
+                }
+                _mm256_storeu_si256((__m256i*)(str + i), _mm256_add_epi16(v, _mm256_and_si256(s_in_class_avx2(v, m.m_class), delta)));
+            }
+            s_map_case_sse2(str + i, len - i, m);
+        }
+#elif defined(CSTRING_SIMD_NEON)
+        static inline bool s_is_ascii_neon(uint16x8_t v) { return vmaxvq_u16(v) < 0x80; }
+
+        static inline uint16x8_t s_in_class_neon(uint16x8_t v, rune_class_t const& c)
+        {
+            uint16x8_t const f = vorrq_u16(v, vdupq_n_u16(c.m_fold));
+            return vandq_u16(vcgeq_u16(f, vdupq_n_u16(c.m_lo)), vcleq_u16(f, vdupq_n_u16(c.m_hi)));
+        }
+
+        static s32 s_span_class_neon(ucs2::pcrune str, s32 len, rune_class_t const& c, bool in)
+        {
+            u64 const flip = in ? ~(u64)0 : 0;
+            s32       i    = 0;
+            for (; (i + 8) <= len; i += 8)
+            {
+                uint16x8_t const v = vld1q_u16(str + i);
+                if (!s_is_ascii_neon(v))
+                {
+                    s32 const n = s_span_class_scalar(str + i, 8, c, in);
+                    if (n < 8)
+                        return i + n;
+                    continue;
+                }
+                u64 const mask = s_neon_mask(s_in_class_neon(v, c)) ^ flip;
+                if (mask != 0)
+                    return i + (nsimd::ctz64(mask) >> 3);
+            }
+            return i + s_span_class_scalar(str + i, len - i, c, in);
+        }
+
+        static void s_map_case_neon(ucs2::prune str, s32 len, case_map_t const& m)
+        {
+            uint16x8_t const delta = vdupq_n_u16((u16)m.m_delta);
+            s32              i     = 0;
+            for (; (i + 8) <= len; i += 8)
+            {
+                uint16x8_t const v = vld1q_u16(str + i);
+                if (!s_is_ascii_neon(v))
+                {
+                    s_map_case_scalar(str + i, 8, m);
+                    continue;
+                }
+                vst1q_u16(str + i, vaddq_u16(v, vandq_u16(s_in_class_neon(v, m.m_class), delta)));
+            }
+            s_map_case_scalar(str + i, len - i, m);
+        }
+#endif
+
+        static s32 s_span_class_impl(ucs2::pcrune str, s32 len, rune_class_t const& c, bool in)
+        {
+            static span_class_fn const s_fn = CSTRING_SIMD_SELECT(s_span_class);
+            return s_fn(str, len, c, in);
+        }
+
+        static void s_map_case_impl(ucs2::prune str, s32 len, case_map_t const& m)
+        {
+            static map_case_fn const s_fn = CSTRING_SIMD_SELECT(s_map_case);
+            s_fn(str, len, m);
+        }
+
+        // Map the case of the runes [@from, @to) of @data where they are, the string is being modified so
+        // no other thread reads them
+        static void s_map_case_in_data(nstring::data_t const* data, s32 from, s32 to, case_map_t const& m)
+        {
+            while (from < to)
+            {
+                run_t const run = s_data_run(data, from);
+                s32 const   end = math::min(run.m_to, to);
+                s_map_case_impl((ucs2::prune)run.m_ptr + (from - run.m_from), end - from, m);
+                from = end;
+            }
+        }
+
+        // The number of runes from the start of @str that are (@in) or are not in class @c
+        static s32 s_span_class_in_view(const nstring::instance_t* str, rune_class_t const& c, bool in)
+        {
+            read_lock_t const lock(str->m_data);
+            s32               pos = str->m_range.m_from;
+            while (pos < str->m_range.m_to)
+            {
+                run_t const run = s_data_run(str->m_data, pos);
+                s32 const   end = math::min(run.m_to, str->m_range.m_to);
+                pos += s_span_class_impl(run.m_ptr + (pos - run.m_from), end - pos, c, in);
+                if (pos < end)
+                    break;
+            }
+            return pos - str->m_range.m_from;
+        }
+
+        // Capitalize the runs of letters in @str, a run is title cased when the last rune before it that is not
+        // a letter is a separator (@sep tells this for the start of @str), and lower cased otherwise
+        template <typename S> static void s_capitalize(ucs2::prune str, s32 len, bool sep, S const& is_separator)
+        {
+            s32 i = 0;
+            while (i < len)
+            {
+                s32 const run = s_span_class_impl(str + i, len - i, c_class_alpha, true);
+                s_map_case_impl(str + i, run, sep ? c_case_title : c_case_lower);
+                i += run;
+                if (i < len)
+                    sep = is_separator(str[i++]);
+            }
+        }
+
+        // Two-Way string matching (Crochemore-Perrin) for long needles, this has a linear worst case
+        // where the candidate filtering above degrades to O(n*m) on repetitive text.
+        // A Horspool shift table keyed on the low byte of the rune skips ahead on the last rune of
+        // the window, collisions only make the shift smaller so it stays safe.
+        // When @reverse is true the needle and haystack are both read back to front, the result is
+        // then the start of the last occurrence in reversed coordinates.
+        static const s32 c_two_way_min_findlen = 9;
+
+        template <bool reverse> static inline ucs2::rune s_rune_at(ucs2::pcrune str, s32 len, s32 i) { return reverse ? str[len - 1 - i] : str[i]; }
+
+        // Returns the critical position of @find and its local period in @period
+        template <bool reverse> static s32 s_critical_factorization(ucs2::pcrune find, s32 findlen, s32& period)
+        {
+            // Maximal suffix for the normal order
+            s32 ms = -1, j = 0, k = 1, p = 1;
+            while (j + k < findlen)
+            {
+                ucs2::rune const a = s_rune_at<reverse>(find, findlen, j + k);
+                ucs2::rune const b = s_rune_at<reverse>(find, findlen, ms + k);
+                if (a < b)
+                {
+                    j += k;
+                    k = 1;
+                    p = j - ms;
+                }
+                else if (a == b)
+                {
+                    if (k != p)
+                        ++k;
+                    else
+                    {
+                        j += p;
+                        k = 1;
+                    }
+                }
+                else
+                {
+                    ms = j++;
+                    k = p = 1;
+                }
+            }
+            period = p;
+
+            // Maximal suffix for the reversed order
+            s32 msr = -1;
+            j = 0, k = 1, p = 1;
+            while (j + k < findlen)
+            {
+                ucs2::rune const a = s_rune_at<reverse>(find, findlen, j + k);
+                ucs2::rune const b = s_rune_at<reverse>(find, findlen, msr + k);
+                if (b < a)
+                {
+                    j += k;
+                    k = 1;
+                    p = j - msr;
+                }
+                else if (a == b)
+                {
+                    if (k != p)
+                        ++k;
+                    else
+                    {
+                        j += p;
+                        k = 1;
+                    }
+                }
+                else
+                {
+                    msr = j++;
+                    k = p = 1;
+                }
+            }
+
+            if (msr < ms)
+                return ms + 1;
+            period = p;
+            return msr + 1;
+        }
+
+        template <bool reverse> static s32 s_find_two_way(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            s32       period;
+            s32 const suffix = s_critical_factorization<reverse>(find, findlen, period);
+
+            s32 shift_table[256];
+            for (s32 i = 0; i < 256; ++i)
+                shift_table[i] = findlen;
+            for (s32 i = 0; i < findlen; ++i)
+                shift_table[s_rune_at<reverse>(find, findlen, i) & 0xFF] = findlen - 1 - i;
+
+            // Is the left half of the factorization a suffix of the periodic right half?
+            bool periodic = true;
+            for (s32 i = 0; i < suffix && periodic; ++i)
+                periodic = s_rune_at<reverse>(find, findlen, i) == s_rune_at<reverse>(find, findlen, i + period);
+
+            s32 j = 0;
+            if (periodic)
+            {
+                // Remember how much of the needle prefix is known to match after a shift by the period
+                s32 memory = 0;
+                while (j <= strlen - findlen)
+                {
+                    s32 shift = shift_table[s_rune_at<reverse>(str, strlen, j + findlen - 1) & 0xFF];
+                    if (shift > 0)
+                    {
+                        if (memory > 0 && shift < period)
+                            shift = findlen - period;
+                        memory = 0;
+                        j += shift;
+                        continue;
+                    }
+                    s32 i = math::max(suffix, memory);
+                    while (i < findlen && s_rune_at<reverse>(find, findlen, i) == s_rune_at<reverse>(str, strlen, i + j))
+                        ++i;
+                    if (i >= findlen)
+                    {
+                        i = suffix - 1;
+                        while (i >= memory && s_rune_at<reverse>(find, findlen, i) == s_rune_at<reverse>(str, strlen, i + j))
+                            --i;
+                        if (i < memory)
+                            return j;
+                        j += period;
+                        memory = findlen - period;
+                    }
+                    else
+                    {
+                        j += i - suffix + 1;
+                        memory = 0;
+                    }
+                }
+            }
+            else
+            {
+                period = math::max(suffix, findlen - suffix) + 1;
+                while (j <= strlen - findlen)
+                {
+                    s32 const shift = shift_table[s_rune_at<reverse>(str, strlen, j + findlen - 1) & 0xFF];
+                    if (shift > 0)
+                    {
+                        j += shift;
+                        continue;
+                    }
+                    s32 i = suffix;
+                    while (i < findlen && s_rune_at<reverse>(find, findlen, i) == s_rune_at<reverse>(str, strlen, i + j))
+                        ++i;
+                    if (i >= findlen)
+                    {
+                        i = suffix - 1;
+                        while (i >= 0 && s_rune_at<reverse>(find, findlen, i) == s_rune_at<reverse>(str, strlen, i + j))
+                            --i;
+                        if (i < 0)
+                            return j;
+                        j += period;
+                    }
+                    else
+                    {
+                        j += i - suffix + 1;
+                    }
+                }
+            }
+            return -1;
+        }
+
+        static inline s32 s_find_runes(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            if (findlen <= 0 || findlen > strlen)
+                return -1;
+            if (findlen >= c_two_way_min_findlen)
+                return s_find_two_way<false>(str, strlen, find, findlen);
+            return s_find_runes_impl(str, strlen, find, findlen);
+        }
+
+        static inline s32 s_find_last_runes(ucs2::pcrune str, s32 strlen, ucs2::pcrune find, s32 findlen)
+        {
+            if (findlen <= 0 || findlen > strlen)
+                return -1;
+            if (findlen >= c_two_way_min_findlen)
+            {
+                s32 const j = s_find_two_way<true>(str, strlen, find, findlen);
+                return j < 0 ? -1 : strlen - j - findlen;
+            }
+            return s_find_last_runes_impl(str, strlen, find, findlen);
+        }
+
+        // An occurrence that crosses the end of a run is searched for in a copy of the runes around that end
+        static const s32 c_find_window_len = 256;  // runes on the stack, a longer window is allocated
+
+        struct find_window_t
+        {
+            find_window_t(s32 findlen)
+                : m_runes(m_local)
+            {
+                if ((2 * findlen) > c_find_window_len)
+                    m_runes = (ucs2::prune)nstring_memory::s_string_alloc->allocate(2 * findlen * sizeof(ucs2::rune));
+            }
+            ~find_window_t()
+            {
+                if (m_runes != m_local)
+                    nstring_memory::s_string_alloc->deallocate(m_runes);
+            }
+
+            ucs2::prune m_runes;
+            ucs2::rune  m_local[c_find_window_len];
+        };
+
+        // Find @find in the runes [@from, @to) of @data that may not be contiguous, returns the position of the
+        // first occurrence or -1. The caller holds a read_lock_t on the data.
+        static s32 s_find_in_data(nstring::data_t const* data, s32 from, s32 to, ucs2::pcrune find, s32 findlen)
+        {
+            if (findlen <= 0 || findlen > (to - from))
+                return -1;
+
+            find_window_t window(findlen);
+            for (s32 pos = from; pos < to;)
+            {
+                run_t const run = s_data_run(data, pos);
+                s32 const   end = math::min(run.m_to, to);
+                s32 const   i   = s_find_runes(run.m_ptr + (pos - run.m_from), end - pos, find, findlen);
+                if (i >= 0)
+                    return pos + i;
+                if (end == to)
+                    break;
+
+                // None of the runes in this run start an occurrence before those that cross its end
+                s32 const lo = math::max(from, end - (findlen - 1));
+                s32 const hi = math::min(to, end + (findlen - 1));
+                s_data_copy(data, lo, hi, window.m_runes);
+                s32 const j = s_find_runes(window.m_runes, hi - lo, find, findlen);
+                if (j >= 0 && (lo + j) < end)
+                    return lo + j;
+                pos = end;
+            }
+            return -1;
+        }
+
+        // Find @find in the runes [@from, @to) of @data that may not be contiguous, returns the position of the
+        // last occurrence or -1. The caller holds a read_lock_t on the data.
+        static s32 s_find_last_in_data(nstring::data_t const* data, s32 from, s32 to, ucs2::pcrune find, s32 findlen)
+        {
+            if (findlen <= 0 || findlen > (to - from))
+                return -1;
+
+            find_window_t window(findlen);
+            for (s32 pos = to; pos > from;)
+            {
+                run_t const run   = s_data_run(data, pos - 1);
+                s32 const   begin = math::max(run.m_from, from);
+                s32 const   i     = s_find_last_runes(run.m_ptr + (begin - run.m_from), pos - begin, find, findlen);
+                if (i >= 0)
+                    return begin + i;
+                if (begin == from)
+                    break;
+
+                s32 const lo = math::max(from, begin - (findlen - 1));
+                s32 const hi = math::min(to, begin + (findlen - 1));
+                s_data_copy(data, lo, hi, window.m_runes);
+                s32 const j = s_find_last_runes(window.m_runes, hi - lo, find, findlen);
+                if (j >= 0 && (lo + j) < begin)
+                    return lo + j;
+                pos = begin;
+            }
+            return -1;
+        }
+
+        // The position of the first rune in [@from, @to) of @data for which @match is true, or -1
+        template <typename M> static s32 s_find_rune_in_data(nstring::data_t const* data, s32 from, s32 to, M const& match)
+        {
+            for (s32 pos = from; pos < to;)
+            {
+                run_t const run = s_data_run(data, pos);
+                s32 const   end = math::min(run.m_to, to);
+                for (; pos < end; ++pos)
+                {
+                    if (match(run.m_ptr[pos - run.m_from]))
+                        return pos;
+                }
+            }
+            return -1;
+        }
+
+        // The position of the last rune in [@from, @to) of @data for which @match is true, or -1
+        template <typename M> static s32 s_find_last_rune_in_data(nstring::data_t const* data, s32 from, s32 to, M const& match)
+        {
+            for (s32 pos = to; pos > from;)
+            {
+                run_t const run   = s_data_run(data, pos - 1);
+                s32 const   begin = math::max(run.m_from, from);
+                for (; pos > begin; --pos)
+                {
+                    if (match(run.m_ptr[pos - 1 - run.m_from]))
+                        return pos - 1;
+                }
+            }
+            return -1;
+        }
+
+        // The number of runes that are equal at @a_from of @a and @b_from of @b, up to @len. The caller holds a
+        // read_lock_t on both.
+        static s32 s_mismatch_in_data(nstring::data_t const* a, s32 a_from, nstring::data_t const* b, s32 b_from, s32 len)
+        {
+            s32 i = 0;
+            while (i < len)
+            {
+                run_t const        ra = s_data_run(a, a_from + i);
+                run_t const        rb = s_data_run(b, b_from + i);
+                s32 const          n  = math::min(len - i, math::min(ra.m_to - (a_from + i), rb.m_to - (b_from + i)));
+                ucs2::pcrune const pa = ra.m_ptr + (a_from + i - ra.m_from);
+                ucs2::pcrune const pb = rb.m_ptr + (b_from + i - rb.m_from);
+                s32 const          j  = pa == pb ? n : s_mismatch_runes_impl(pa, pb, n);
+                i += j;
+                if (j < n)
+                    break;
+            }
+            return i;
+        }
+
+        // Find the @findlen runes of @find in @str, returns the local position of the first occurrence or -1
+        static s32 s_find_in_view(const nstring::instance_t* str, ucs2::pcrune find, s32 findlen)
+        {
+            read_lock_t const lock(str->m_data);
+            s32 const         i = s_find_in_data(str->m_data, str->m_range.m_from, str->m_range.m_to, find, findlen);
+            return i < 0 ? -1 : i - str->m_range.m_from;
+        }
+
+        // Find @find in @str, returns the local range of the first occurrence
+        static nstring::range_t s_find(const nstring::instance_t* str, const nstring::instance_t* find)
+        {
+            s32 const i = s_find_in_view(str, find->m_data->m_ptr + find->m_range.m_from, find->size());
+            if (i < 0)
+                return {0, 0};
+            return {i, i + find->size()};
+        }
+
+        // Find @find in @str, returns the local range of the last occurrence
+        static nstring::range_t s_find_last(const nstring::instance_t* str, const nstring::instance_t* find)
+        {
+            read_lock_t const lock(str->m_data);
+            s32 const         i = s_find_last_in_data(str->m_data, str->m_range.m_from, str->m_range.m_to, find->m_data->m_ptr + find->m_range.m_from, find->size());
+            if (i < 0)
+                return {0, 0};
+            return {i - str->m_range.m_from, i - str->m_range.m_from + find->size()};
+        }
+
+        // The local position of the first rune of @str for which @match is true, or -1
+        template <typename M> static s32 s_find_rune(const nstring::instance_t* str, M const& match)
+        {
+            read_lock_t const lock(str->m_data);
+            s32 const         i = s_find_rune_in_data(str->m_data, str->m_range.m_from, str->m_range.m_to, match);
+            return i < 0 ? -1 : i - str->m_range.m_from;
+        }
+
+        // The local position of the last rune of @str for which @match is true, or -1
+        template <typename M> static s32 s_find_last_rune(const nstring::instance_t* str, M const& match)
+        {
+            read_lock_t const lock(str->m_data);
+            s32 const         i = s_find_last_rune_in_data(str->m_data, str->m_range.m_from, str->m_range.m_to, match);
+            return i < 0 ? -1 : i - str->m_range.m_from;
+        }
+
+        // Double the capacity of a scratch array that started out as the on-stack @local array
+        static s32* s_grow_scratch(s32* array, s32 const* local, s32 count, s32& capacity)
+        {
+            s32* grown = (s32*)nstring_memory::s_string_alloc->allocate(capacity * 2 * sizeof(s32));
+            nmem::memcpy(grown, array, count * sizeof(s32));
+            if (array != local)
+                nstring_memory::s_string_alloc->deallocate(array);
+            capacity *= 2;
+            return grown;
+        }
+
+        // Map the absolute position @pos to where it ends up after each of the @count (ascending) matches
+        // of @findlen runes has been replaced by @replacelen runes, a position inside a match keeps its
+        // offset as far as the replacement allows.
+        static s32 s_map_replaced_pos(s32 pos, s32 const* matches, s32 count, s32 findlen, s32 replacelen)
+        {
+            // Binary search for the number of matches that start before @pos
+            s32 lo = 0;
+            s32 hi = count;
+            while (lo < hi)
+            {
+                s32 const mid = (lo + hi) >> 1;
+                if (matches[mid] < pos)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == 0)
+                return pos;
+
+            s32 const delta = replacelen - findlen;
+            s32 const last  = matches[lo - 1];
+            if (pos >= last + findlen)
+                return pos + lo * delta;
+            return last + (lo - 1) * delta + math::min(pos - last, replacelen);
+        }
+
+        // Index visitor for one match (or run) of an edit that adjusts the parked views match by match from
+        // right to left. A view that has its start moved leaves the index, see s_index_visit(), so it also
+        // has to be adjusted for the matches to the left of this one.
+        template <typename M> struct map_at_t
+        {
+            M m_at;
+            M m_left;
+
+            void operator()(nstring::instance_t* v) const
+            {
+                s32 const from = v->m_range.m_from;
+                m_at(v);
+                if (v->m_range.m_from != from)
+                    m_left(v);
+            }
+        };
+
+        // Map the range of a view, a view that has its content completely replaced by nothing is invalidated
+        struct map_replaced_t
+        {
+            s32 const* m_matches;
+            s32        m_count;
+            s32        m_findlen;
+            s32        m_replacelen;
+
+            void operator()(nstring::instance_t* v) const
+            {
+                s32 const from = s_map_replaced_pos(v->m_range.m_from, m_matches, m_count, m_findlen, m_replacelen);
+                s32 const to   = s_map_replaced_pos(v->m_range.m_to, m_matches, m_count, m_findlen, m_replacelen);
+                if (from == to && v->m_range.m_from != v->m_range.m_to)
+                {
+                    v->m_range.m_from = v->m_range.m_to = 0;
+                }
+                else
+                {
+                    v->m_range.m_from = from;
+                    v->m_range.m_to   = to;
+                }
+            }
+        };
+
+        // Adjust all the active views on the data of @str in one sweep, the parked views are adjusted per
+        // match from right to left so that the positions of the matches still to do remain valid. Such an
+        // edit is not logged, the active views first catch up with the log.
+        static void s_adjust_views_for_replace(nstring::instance_t* str, s32 const* matches, s32 count, s32 findlen, s32 replacelen)
+        {
+            s_log_flush(str->m_data);
+
+            map_replaced_t const map    = {matches, count, findlen, replacelen};
+            s32                  active = 0;
+            nstring::instance_t* iter   = str;
+            do
+            {
+                map(iter);
+                iter = iter->m_next;
+                ++active;
+            } while (iter != str);
+
+            for (s32 m = count - 1; m >= 0 && str->m_data->m_index != nullptr; --m)
+            {
+                map_at_t<map_replaced_t> const one = {{matches + m, 1, findlen, replacelen}, {matches, m, findlen, replacelen}};
+                s_index_edit(str->m_data, matches[m], matches[m] + findlen, replacelen - findlen, one);
+            }
+            s_park_views(str, active);
+        }
+
+        // Replace the runes at each of the @count (absolute, ascending) @matches with @replace, the data
+        // is resized at most once and every rune is moved at most once.
+        static void s_replace_matches(nstring::instance_t* str, s32 const* matches, s32 count, s32 findlen, const nstring::instance_t* replace)
+        {
+            nstring::data_t* data       = str->m_data;
+            s32 const        replacelen = replace->size();
+            s32 const        oldlen     = data->m_len;
+            s32 const        newlen     = oldlen + count * (replacelen - findlen);
+            s_resize_data(data, newlen);
+
+            ucs2::prune        runes = data->m_ptr;
+            ucs2::pcrune const rdata = replace->m_data->m_ptr + replace->m_range.m_from;
+            if (replacelen <= findlen)
+            {
+                // The string gets shorter, compact from left to right
+                s32 dst = matches[0];
+                for (s32 m = 0; m < count; ++m)
+                {
+                    nmem::memcpy(runes + dst, rdata, replacelen * sizeof(ucs2::rune));
+                    dst += replacelen;
+                    s32 const src = matches[m] + findlen;
+                    s32 const end = (m + 1) < count ? matches[m + 1] : oldlen;
+                    if (dst != src)
+                        nmem::memmove(runes + dst, runes + src, (end - src) * sizeof(ucs2::rune));
+                    dst += end - src;
+                }
+            }
+            else
+            {
+                // The string gets longer, move from right to left
+                s32 dst = newlen;
+                for (s32 m = count - 1; m >= 0; --m)
+                {
+                    s32 const src = matches[m] + findlen;
+                    s32 const end = (m + 1) < count ? matches[m + 1] : oldlen;
+                    dst -= end - src;
+                    nmem::memmove(runes + dst, runes + src, (end - src) * sizeof(ucs2::rune));
+                    dst -= replacelen;
+                    nmem::memcpy(runes + dst, rdata, replacelen * sizeof(ucs2::rune));
+                }
+            }
+            data->m_len   = newlen;
+            runes[newlen] = '\0';
+
+            s_adjust_views_for_replace(str, matches, count, findlen, replacelen);
+        }
+
+        // Replace up to @ntimes non-overlapping occurrences of @find in @str with @replace, returns the
+        // number of replacements. All the matches are collected in one scan before the string is changed.
+        static s32 s_find_replace(nstring::instance_t* str, const nstring::instance_t* find, const nstring::instance_t* replace, s32 ntimes)
+        {
+            s32 const findlen = find->size();
+            if (findlen == 0 || ntimes <= 0)
+                return 0;
+
+            s32  local[32];
+            s32* matches  = local;
+            s32  capacity = sizeof(local) / sizeof(local[0]);
+            s32  count    = 0;
+
+            ucs2::pcrune const strdata  = str->m_data->m_ptr;
+            ucs2::pcrune const finddata = find->m_data->m_ptr + find->m_range.m_from;
+            s32                pos      = str->m_range.m_from;
+            while (count < ntimes)
+            {
+                s32 const i = s_find_runes(strdata + pos, str->m_range.m_to - pos, finddata, findlen);
+                if (i < 0)
+                    break;
+                if (count == capacity)
+                    matches = s_grow_scratch(matches, local, count, capacity);
+                matches[count++] = pos + i;
+                pos += i + findlen;
+            }
+
+            if (count > 0)
+                s_replace_matches(str, matches, count, findlen, replace);
+
+            if (matches != local)
+                nstring_memory::s_string_alloc->deallocate(matches);
+            return count;
+        }
+
+        // Map the absolute position @pos to where it ends up after the removal of @count (ascending) runs,
+        // @runs holds a pair per run with its (original) start and the number of runes removed up to and
+        // including that run. A position inside a run moves to where the run was.
+        static s32 s_map_removed_pos(s32 pos, s32 const* runs, s32 count)
+        {
+            s32 lo = 0;
+            s32 hi = count;
+            while (lo < hi)
+            {
+                s32 const mid = (lo + hi) >> 1;
+                if (runs[mid * 2] < pos)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == 0)
+                return pos;
+
+            s32 const* run    = runs + (lo - 1) * 2;
+            s32 const  before = lo > 1 ? run[-1] : 0;
+            if (pos >= run[0] + (run[1] - before))
+                return pos - run[1];
+            return run[0] - before;
+        }
+
+        struct map_removed_t
+        {
+            s32 const* m_runs;
+            s32        m_count;
+
+            void operator()(nstring::instance_t* v) const
+            {
+                s32 const from = s_map_removed_pos(v->m_range.m_from, m_runs, m_count);
+                s32 const to   = s_map_removed_pos(v->m_range.m_to, m_runs, m_count);
+                if (from == to && v->m_range.m_from != v->m_range.m_to)
+                {
+                    v->m_range.m_from = v->m_range.m_to = 0;
+                }
+                else
+                {
+                    v->m_range.m_from = from;
+                    v->m_range.m_to   = to;
+                }
+            }
+        };
+
+        static void s_adjust_views_for_removal(nstring::instance_t* str, s32 const* runs, s32 count)
+        {
+            s_log_flush(str->m_data);
+
+            map_removed_t const  map    = {runs, count};
+            s32                  active = 0;
+            nstring::instance_t* iter   = str;
+            do
+            {
+                map(iter);
+                iter = iter->m_next;
+                ++active;
+            } while (iter != str);
+
+            // The parked views are adjusted per run from right to left, a single run is passed as its
+            // start and length
+            for (s32 r = count - 1; r >= 0 && str->m_data->m_index != nullptr; --r)
+            {
+                s32 const                     len    = runs[r * 2 + 1] - (r > 0 ? runs[r * 2 - 1] : 0);
+                s32 const                     run[2] = {runs[r * 2], len};
+                map_at_t<map_removed_t> const one    = {{run, 1}, {runs, r}};
+                s_index_edit(str->m_data, run[0], run[0] + len, -len, one);
+            }
+            s_park_views(str, active);
+        }
+
+        struct match_rune_t
+        {
+            uchar32 m_rune;
+            inline bool operator()(uchar32 c) const { return c == m_rune; }
+        };
+
+        struct match_set_t
+        {
+            const charset_t& m_set;
+            inline bool      operator()(uchar32 c) const { return m_set.contains(c); }
+        };
+
+        struct match_space_t
+        {
+            inline bool operator()(uchar32 c) const { return c < 0x10000 && nbmp::is_space((uchar16)c); }
+        };
+
+        // Remove up to @ntimes runes of @str for which @match is true in one compaction pass, returns the
+        // number of removed runes. The removed runs are recorded so that the views on the string can be
+        // adjusted in one sweep afterwards.
+        template <typename M> static s32 s_remove_if(nstring::instance_t* str, M const& match, s32 ntimes)
+        {
+            nstring::data_t* data = str->m_data;
+            if (str->is_empty() || ntimes <= 0)
+                return 0;
+
+            s32  local[64];
+            s32* runs     = local;
+            s32  capacity = sizeof(local) / sizeof(local[0]);
+            s32  count    = 0;
+
+            ucs2::prune strdata = data->m_ptr;
+            s32 const   end     = str->m_range.m_to;
+            s32         d       = str->m_range.m_from;
+            s32         n       = 0;
+            for (s32 i = d; i < end; ++i)
+            {
+                uchar32 const c = strdata[i];
+                if (n < ntimes && match(c))
+                {
+                    // Extend the current run or start a new one
+                    if (count > 0 && (runs[count - 2] + (runs[count - 1] - (count > 2 ? runs[count - 3] : 0))) == i)
+                    {
+                        runs[count - 1] += 1;
+                    }
+                    else
+                    {
+                        if (count == capacity)
+                            runs = s_grow_scratch(runs, local, count, capacity);
+                        runs[count++] = i;
+                        runs[count++] = n + 1;
+                    }
+                    ++n;
+                    continue;
+                }
+                strdata[d++] = (ucs2::rune)c;
+            }
+
+            if (n > 0)
+            {
+                // Move the part of the string beyond this view in one go
+                nmem::memmove(strdata + d, strdata + end, (data->m_len - end) * sizeof(ucs2::rune));
+                data->m_len -= n;
+                strdata[data->m_len] = '\0';
+                s_adjust_views_for_removal(str, runs, count / 2);
+            }
+
+            if (runs != local)
+                nstring_memory::s_string_alloc->deallocate(runs);
+            return n;
+        }
+
+        static const s32 NONE     = 0;
+        static const s32 LEFT     = 0x0800;  // binary(0000,1000,0000,0000);
         static const s32 RIGHT    = 0x0010;  // binary(0000,0000,0001,0000);
         static const s32 INSIDE   = 0x0180;  // binary(0000,0001,1000,0000);
         static const s32 MATCH    = 0x03C0;  // binary(0000,0011,1100,0000);
         static const s32 OVERLAP  = 0x07E0;  // binary(0000,0111,1110,0000);
         static const s32 ENVELOPE = 0x37EC;  // binary(0011,0111,1110,1100);
 
-        static s32 s_compare(s32 lhs_from, s32 lhs_to, s32 rhs_from, s32 rhs_to)
+        static s32 s_compare(s32 lhs_from, s32 lhs_to, s32 rhs_from, s32 rhs_to)
+        {
+            // Return where 'rhs' is in relation to 'lhs'
+            // --------| lhs |--------[ rhs ]--------        RIGHT
+            // --------[ rhs ]--------| lhs |--------        LEFT
+            // --------[ rhs ]          lhs |--------        LEFT INSIDE
+            // --------|     lhs      [ rhs ]--------        RIGHT INSIDE
+            // --------|    [ rhs ]     lhs |--------        INSIDE
+            // --------[     rhs  lhs       ]--------        MATCH
+            // --------[ rhs    |    ]  lhs |--------        LEFT OVERLAP
+            // --------| lhs    [    |  rhs ]--------        RIGHT OVERLAP
+            // --------[    | lhs |     rhs ]--------        ENVELOPE
+            // --------[ lhs |          rhs ]--------        LEFT ENVELOPE
+            // --------[ rhs         |  lhs ]--------        RIGHT ENVELOPE
+            if (lhs_to <= rhs_from)
+                return RIGHT;
+            else if (lhs_from >= rhs_to)
+                return LEFT;
+            else if (lhs_from == rhs_from && lhs_to > rhs_to)
+                return LEFT | INSIDE;
+            else if (lhs_from < rhs_from && lhs_to == rhs_to)
+                return RIGHT | INSIDE;
+            else if (lhs_from < rhs_from && lhs_to > rhs_to)
+                return INSIDE;
+            else if (lhs_from == rhs_from && lhs_to == rhs_to)
+                return MATCH;
+            else if (rhs_from < lhs_from && rhs_to < lhs_to)
+                return LEFT | OVERLAP;
+            else if (rhs_from > lhs_from && rhs_to > lhs_to)
+                return RIGHT | OVERLAP;
+            else if (lhs_from == rhs_from && lhs_to < rhs_to)
+                return LEFT | ENVELOPE;
+            else if (rhs_from < lhs_from && lhs_to == rhs_to)
+                return RIGHT | ENVELOPE;
+            else if (rhs_from < lhs_from && rhs_to > lhs_to)
+                return ENVELOPE;
+            return NONE;
+        }
+
+        static inline s32 s_compute_range_overlap(s32 lhs_from, s32 lhs_to, s32 rhs_from, s32 rhs_to)
+        {
+            if (rhs_from < lhs_from && rhs_to < lhs_to)
+                return rhs_to - lhs_from;
+            else if (rhs_from > lhs_from && rhs_to > lhs_to)
+                return lhs_to - rhs_from;
+            return 0;
+        }
+
+        // When the string is modified views can become invalid, here we try to keep them
+        // 'correct' as much as we can. For example when we insert text into the string we
+        // can correct all of the existing views.
+        // Removal of text from a string may invalidate views that intersect with the range
+        // of text that is removed.
+        // Clear and Reset will invalidate all views on the string.
+        static void s_adjust_active_view(nstring::instance_t* v, s32 op_code, s32 rhs_from, s32 rhs_to)
+        {
+            s32& lhs_from = v->m_range.m_from;
+            s32& lhs_to   = v->m_range.m_to;
+
+            switch (op_code)
+            {
+                case REMOVAL:
+                {
+                    // --------| lhs |--------[ rhs ]--------        RIGHT = NOTHING
+                    // --------[ rhs ]--------| lhs |--------        LEFT = SHIFT LEFT rhs.size()
+                    // --------|    [ rhs ]     lhs |--------        INSIDE = NARROW RIGHT by rhs.size()
+                    // --------[ rhs ]          lhs |--------        LEFT INSIDE = NARROW RIGHT by rhs.size()
+                    // --------|     lhs      [ rhs ]--------        RIGHT INSIDE = NARROW RIGHT by rhs.size()
+                    // --------[     rhs  lhs       ]--------        MATCH = INVALIDATE
+                    // --------[ rhs    |    ]  lhs |--------        LEFT OVERLAP = NARROW LEFT by overlap & SHIFT LEFT by rhs.size()-overlap
+                    // --------| lhs    [    |  rhs ]--------        RIGHT OVERLAP = NARROW RIGHT by overlap
+                    // --------[    | lhs |     rhs ]--------        ENVELOPE = INVALIDATE
+                    // --------[ lhs |          rhs ]--------        LEFT ENVELOPE = INVALIDATE
+                    // --------[ rhs         |  lhs ]--------        RIGHT ENVELOPE = INVALIDATE
+                    s32 const c = s_compare(lhs_from, lhs_to, rhs_from, rhs_to);
+                    switch (c)
+                    {
+                        case LEFT:
+                            lhs_from -= (rhs_to - rhs_from);
+                            lhs_to -= (rhs_to - rhs_from);
+                            break;
+                        case INSIDE:
+                        case LEFT | INSIDE:
+                        case RIGHT | INSIDE: lhs_to -= (rhs_to - rhs_from); break;
+                        case MATCH:
+                        case ENVELOPE:
+                        case LEFT | ENVELOPE:
+                        case RIGHT | ENVELOPE: lhs_from = lhs_to = 0; break;
+                        case LEFT | OVERLAP:
+                            lhs_from = rhs_from;
+                            lhs_to -= (rhs_to - rhs_from);
+                            break;
+                        case RIGHT | OVERLAP: lhs_to -= s_compute_range_overlap(lhs_from, lhs_to, rhs_from, rhs_to); break;
+                        case RIGHT: break;
+                    }
+                }
+                break;
+
+                case INSERTION:
+                {
+                    // Insertion happens at rhs.from
+                    // --------| lhs |--------[ rhs ]--------        RIGHT = DO NOTHING
+                    // --------[     rhs  lhs       ]--------        MATCH = SHIFT RIGHT by rhs.size()
+                    // --------[ rhs ]--------| lhs |--------        LEFT = SHIFT RIGHT by rhs.size()
+                    // --------[    | lhs |     rhs ]--------        ENVELOPE = SHIFT RIGHT by rhs.size()
+                    // --------[ lhs |          rhs ]--------        LEFT ENVELOPE = SHIFT RIGHT by rhs.size()
+                    // --------[ rhs         |  lhs ]--------        RIGHT ENVELOPE = SHIFT RIGHT by rhs.size()
+                    // --------[ rhs    |    ]  lhs |--------        LEFT OVERLAP = SHIFT RIGHT by rhs.size()
+                    // --------[ rhs ]          lhs |--------        LEFT INSIDE = SHIFT RIGHT by rhs.size()
+                    // --------|    [ rhs ]     lhs |--------        INSIDE = EXTEND RIGHT by rhs.size()
+                    // --------|     lhs      [ rhs ]--------        RIGHT INSIDE = EXTEND RIGHT by rhs.size()
+                    // --------| lhs    [    |  rhs ]--------        RIGHT OVERLAP = EXTEND RIGHT by rhs.size()
+                    s32 const c = s_compare(lhs_from, lhs_to, rhs_from, rhs_to);
+                    switch (c)
+                    {
+                        case RIGHT: break;
+                        case MATCH:
+                        case LEFT:
+                        case ENVELOPE:
+                        case (LEFT | ENVELOPE):
+                        case (RIGHT | ENVELOPE):
+                        case (LEFT | OVERLAP):
+                        case (LEFT | INSIDE):
+                            lhs_to += (rhs_to - rhs_from);
+                            lhs_from += (rhs_to - rhs_from);
+                            break;
+                        case INSIDE:
+                        case (RIGHT | INSIDE):
+                        case (RIGHT | OVERLAP): lhs_to += (rhs_to - rhs_from); break;
+                    }
+                }
+                break;
+
+                case CLEARED:
+                case RELEASED:
+                {
+                    lhs_from = lhs_to = 0;
+                }
+                break;
+            }
+        }
+
+        //------------------------------------------------------------------------------
+        //------------ edit log --------------------------------------------------------
+        //------------------------------------------------------------------------------
+        // The log is allocated by the first edit that leaves other active views behind, the views in the
+        // list are all up to date at that point.
+        static edit_log_t* s_log_alloc(nstring::data_t* data)
+        {
+            edit_log_t* log = (edit_log_t*)nstring_memory::s_alloc_runes(sizeof(edit_log_t), data->m_arena);
+            log->m_base     = 0;
+            log->m_count    = 0;
+            log->m_active   = 0;
+
+            nstring::instance_t* iter = data->m_head;
+            do
+            {
+                iter->m_gen = 0;
+                log->m_active++;
+                iter = iter->m_next;
+            } while (iter != data->m_head);
+
+            log->m_current = log->m_active;
+            data->m_log    = log;
+            return log;
+        }
+
+        // Apply the logged edits that @v has not seen yet
+        static void s_log_apply(nstring::instance_t* v, edit_log_t const* log)
+        {
+            for (s32 i = (s32)(v->m_gen - log->m_base); i < log->m_count; ++i)
+                s_adjust_active_view(v, log->m_edits[i].m_op_code, log->m_edits[i].m_from, log->m_edits[i].m_to);
+            v->m_gen = log->gen();
+        }
+
+        static void s_log_replay(nstring::instance_t* v)
+        {
+            edit_log_t* log = v->m_data->m_log;
+            s_log_apply(v, log);
+            log->m_current++;
+            log->compact();
+        }
+
+        // Bring all the active views up to date, this empties the log
+        static void s_log_flush(nstring::data_t* data)
+        {
+            edit_log_t* log = data->m_log;
+            if (log == nullptr || log->m_count == 0)
+                return;
+
+            u32 const            gen  = log->gen();
+            nstring::instance_t* iter = data->m_head;
+            do
+            {
+                if (iter->m_gen != gen)
+                    s_log_apply(iter, log);
+                iter = iter->m_next;
+            } while (iter != data->m_head);
+
+            log->m_current = log->m_active;
+            log->compact();
+        }
+
+        // Log an edit made through @str, the range of @str itself has already been adjusted
+        static void s_log_edit(nstring::instance_t* str, s32 op_code, s32 from, s32 to)
+        {
+            edit_log_t* log = str->m_data->m_log;
+            if (log == nullptr)
+                log = s_log_alloc(str->m_data);
+            else if (log->m_count == c_edit_log_max)
+                s_log_flush(str->m_data);
+
+            log->m_edits[log->m_count] = {op_code, from, to};
+            log->m_count++;
+            log->m_current = 1;
+            str->m_gen     = log->gen();
+        }
+
+        //------------------------------------------------------------------------------
+        //------------ view index ------------------------------------------------------
+        //------------------------------------------------------------------------------
+        // A string with many views (e.g. a buffer with a slice per token) parks most of them in an index
+        // so that an edit does not have to walk all of them. The parked views are held in slots sorted on
+        // their m_from, a segment tree over the slots holds a pending shift per node and the maximum from
+        // and to of the views below it. An edit shifts all the views to its right in O(log n) and only
+        // visits the parked views that overlap with it. A parked view is moved back to the list of active
+        // views when it is accessed, see s_sync().
+        static const s32 c_view_index_min_active = 64;           // an edit parks the active views when there are more than this
+        static const s32 c_view_index_dead       = -0x40000000;  // maximum from/to of a node without views
+
+        struct view_index_t
+        {
+            instance_t** m_views;     // view per slot, nullptr when the slot is empty
+            s32*         m_from;      // range per slot, excluding the pending shifts of the nodes above it
+            s32*         m_to;        //
+            s32*         m_shift;     // pending shift per internal node, node 1 is the root
+            s32*         m_max_from;  // maximum from of the views below a node, slot i is node m_size + i
+            s32*         m_max_to;    // maximum to of the views below a node
+            s32          m_size;      // number of slots, a power of two
+            s32          m_used;      // number of slots that have been filled, the rest is empty
+            s32          m_parked;    // number of parked views
+        };
+
+        static view_index_t* s_index_alloc(nstring::data_t* data, s32 count)
+        {
+            s32 size = 1;
+            while (size < count)
+                size <<= 1;
+
+            u32 const     bytes = sizeof(view_index_t) + size * sizeof(instance_t*) + (size * 3 + size * 2 * 2) * sizeof(s32);
+            view_index_t* index = (view_index_t*)nstring_memory::s_alloc_runes(bytes, data->m_arena);
+            index->m_views      = (instance_t**)(index + 1);
+            index->m_from       = (s32*)(index->m_views + size);
+            index->m_to         = index->m_from + size;
+            index->m_shift      = index->m_to + size;
+            index->m_max_from   = index->m_shift + size;
+            index->m_max_to     = index->m_max_from + size * 2;
+            index->m_size       = size;
+            index->m_used       = 0;
+            index->m_parked     = 0;
+            return index;
+        }
+
+        static void s_index_pull(view_index_t* index, s32 node)
+        {
+            s32 const l             = node * 2;
+            index->m_max_from[node] = math::max(index->m_max_from[l], index->m_max_from[l + 1]) + index->m_shift[node];
+            index->m_max_to[node]   = math::max(index->m_max_to[l], index->m_max_to[l + 1]) + index->m_shift[node];
+        }
+
+        static void s_index_pull_path(view_index_t* index, s32 slot)
+        {
+            for (s32 node = (index->m_size + slot) >> 1; node >= 1; node >>= 1)
+                s_index_pull(index, node);
+        }
+
+        static void s_index_set_leaf(view_index_t* index, s32 slot)
+        {
+            s32 const node = index->m_size + slot;
+            if (index->m_views[slot] != nullptr)
+            {
+                index->m_max_from[node] = index->m_from[slot];
+                index->m_max_to[node]   = index->m_to[slot];
+            }
+            else
+            {
+                index->m_max_from[node] = index->m_max_to[node] = c_view_index_dead;
+            }
+        }
+
+        // Sum of the pending shifts of the nodes above @slot
+        static s32 s_index_shift_of(view_index_t const* index, s32 slot)
+        {
+            s32 shift = 0;
+            for (s32 node = (index->m_size + slot) >> 1; node >= 1; node >>= 1)
+                shift += index->m_shift[node];
+            return shift;
+        }
+
+        static void s_index_apply(view_index_t* index, s32 node, s32 shift)
+        {
+            if (node >= index->m_size)
+            {
+                index->m_from[node - index->m_size] += shift;
+                index->m_to[node - index->m_size] += shift;
+            }
+            else
+            {
+                index->m_shift[node] += shift;
+            }
+            index->m_max_from[node] += shift;
+            index->m_max_to[node] += shift;
+        }
+
+        // Shift the views in the slots [@from, @to) by @shift
+        static void s_index_shift(view_index_t* index, s32 from, s32 to, s32 shift)
+        {
+            if (from >= to || shift == 0)
+                return;
+            s32 l = from + index->m_size;
+            s32 r = to + index->m_size;
+            while (l < r)
+            {
+                if (l & 1)
+                    s_index_apply(index, l++, shift);
+                if (r & 1)
+                    s_index_apply(index, --r, shift);
+                l >>= 1;
+                r >>= 1;
+            }
+            s_index_pull_path(index, from);
+            s_index_pull_path(index, to - 1);
+        }
+
+        // The first slot with a view that starts after @pos, m_used when there is none
+        static s32 s_index_first_after(view_index_t const* index, s32 pos)
+        {
+            if (index->m_max_from[1] <= pos)
+                return index->m_used;
+            s32 node  = 1;
+            s32 shift = 0;
+            while (node < index->m_size)
+            {
+                shift += index->m_shift[node];
+                node *= 2;
+                if (index->m_max_from[node] + shift <= pos)
+                    node += 1;
+            }
+            return node - index->m_size;
+        }
+
+        static void s_index_release(nstring::data_t* data)
+        {
+            nstring_memory::s_free_runes(data->m_index, s_in_arena(data));
+            data->m_index = nullptr;
+        }
+
+        // Empty the slot of a parked view
+        static void s_index_remove(nstring::data_t* data, s32 slot)
+        {
+            view_index_t* index   = data->m_index;
+            index->m_views[slot] = nullptr;
+            if (--index->m_parked == 0)
+            {
+                s_index_release(data);
+                return;
+            }
+            s_index_set_leaf(index, slot);
+            s_index_pull_path(index, slot);
+        }
+
+        // Move a parked view back to the list of active views
+        static void s_unpark(nstring::instance_t* v)
+        {
+            view_index_t* index = v->m_data->m_index;
+            s32 const     slot  = v->m_slot;
+            s32 const     shift = s_index_shift_of(index, slot);
+            v->m_range          = {index->m_from[slot] + shift, index->m_to[slot] + shift};
+            v->m_slot           = -1;
+            s_index_remove(v->m_data, slot);
+            v->m_data->addToList(v);
+        }
+
+        // Bring the range of @v up to date, this should be done before a view is used. Views of the
+        // same data may be used from different threads, so the shared index and log are locked.
+        static inline void s_sync(nstring::instance_t* v)
+        {
+            nstring::data_t* data = v->m_data;
+            if (v->m_slot < 0 && data->m_log == nullptr)
+                return;
+
+            natomic::scoped_lock_t lock(&data->m_lock);
+            if (v->m_slot >= 0)
+                s_unpark(v);
+            else if (data->m_log != nullptr && v->m_gen != data->m_log->gen())
+                s_log_replay(v);
+        }
+
+        // Stop tracking @v, it is either parked or in the list of active views
+        static void s_untrack(nstring::instance_t* v)
+        {
+            if ((v->m_data->m_flags & c_data_frozen) != 0)
+                return;
+            natomic::scoped_lock_t lock(&v->m_data->m_lock);
+            if (v->m_slot >= 0)
+            {
+                s_index_remove(v->m_data, v->m_slot);
+                v->m_slot = -1;
+            }
+            else
+            {
+                v->m_data->remFromList(v);
+            }
+        }
+
+        // Make the data of @v immutable, all of its views are brought up to date and are no longer tracked
+        static void s_freeze(nstring::instance_t* v)
+        {
+            nstring::data_t* data = v->share();
+            if (s_is_default_data(data) || (data->m_flags & c_data_frozen) != 0)
+                return;
+
+            // The index is released when its last view is unparked
+            for (s32 slot = 0; data->m_index != nullptr && slot < data->m_index->m_used; ++slot)
+            {
+                if (data->m_index->m_views[slot] != nullptr)
+                    s_unpark(data->m_index->m_views[slot]);
+            }
+            if (data->m_log != nullptr)
+            {
+                s_log_flush(data);
+                nstring_memory::s_free_runes(data->m_log, s_in_arena(data));
+                data->m_log = nullptr;
+            }
+
+            nstring::instance_t* iter = data->m_head;
+            do
+            {
+                nstring::instance_t* next = iter->m_next;
+                iter->m_next = iter->m_prev = iter;
+                iter->m_slot                = -1;
+                iter                        = next;
+            } while (iter != data->m_head);
+            data->m_head = nullptr;
+            data->m_flags &= ~c_data_clones;
+            data->m_flags |= c_data_frozen;
+        }
+
+        // Give @v its own copy of the runes in its range, for a view on frozen data or a clone that is about to
+        // stop sharing. The copy is allocated where @v is, not in the current arena scope, so that it lives as
+        // long as @v. Returns the shift that moves a range on the old data to the same runes on the copy.
+        static s32 s_copy_runes(nstring::instance_t* v)
+        {
+            nstring::data_t* data  = v->m_data;
+            s32 const        shift = -v->m_range.m_from;
+            s_untrack(v);
+            v->m_slot  = -1;
+            v->m_data  = s_unique_data(data, v->m_range.m_from, v->m_range.m_to, v->m_arena)->attach();
+            v->m_range = {0, v->m_range.m_to + shift};
+            s_track(v);
+            data->detach();
+            return shift;
+        }
+
+        // The data is about to be modified, its clones keep the runes as they are now. Each clone gets its copy
+        // where that clone lives, see s_copy_runes().
+        static void s_copy_clones(nstring::data_t* data)
+        {
+            if (data->m_head != nullptr)
+            {
+                nstring::instance_t* iter = data->m_head->m_prev;
+                while (true)
+                {
+                    nstring::instance_t* prev = iter->m_prev;
+                    bool const           last = iter == data->m_head;
+                    if (iter->m_slot == c_slot_clone)
+                        s_copy_runes(iter);
+                    if (last)
+                        break;
+                    iter = prev;
+                }
+            }
+            data->m_flags &= ~c_data_clones;
+        }
+
+        static s32 s_make_writable(nstring::instance_t* v)
+        {
+            nstring::data_t* data = v->m_data;
+            if (v->m_slot == c_slot_clone)
+            {
+                // The last view of the data can keep it
+                if (natomic::load(&data->m_ref) != 1)
+                    return s_copy_runes(v);
+                v->m_slot = -1;
+            }
+            else if ((data->m_flags & c_data_frozen) != 0)
+            {
+                return s_copy_runes(v);
+            }
+            else if ((data->m_flags & c_data_clones) != 0)
+            {
+                s_copy_clones(data);
+            }
+
+            // The runes are about to change
+            if ((data->m_flags & c_data_hashed) != 0)
+                data->m_flags &= ~c_data_hashed;
+            return 0;
+        }
+
+        // A clone shares the data of @v until either of them is modified, small strings are copied right away
+        static nstring::instance_t* s_clone(nstring::instance_t* v)
+        {
+            nstring::data_t* data = v->m_data;
+            if ((data->m_flags & c_data_frozen) != 0)
+                return s_alloc_instance(v->m_range, data);
+#if CSTRING_THREAD_SAFE
+            // A clone may be handed to another thread, it should not share a tracked view list
+            return v->clone_full();
+#else
+            if (s_is_default_data(data) || data->is_embedded())
+                return v->clone_full();
+
+            nstring::instance_t* c = s_alloc_instance(v->m_range, data);
+            c->m_slot              = c_slot_clone;
+            data->m_flags |= c_data_clones;
+            return c;
+#endif
+        }
+
+        //------------------------------------------------------------------------------
+        //------------ hash ------------------------------------------------------------
+        //------------------------------------------------------------------------------
+        // The hash reads the runes as bytes. Short strings are mixed with 128-bit multiplies (as in wyhash),
+        // long strings are accumulated in 64-byte stripes by 8 lanes (as in xxh3), which maps directly onto
+        // SSE2/AVX2/NEON. All the implementations give the same value.
+        static const u64 c_hash_keys[8] = {0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+                                           0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull};
+        static const u64 c_hash_prime1  = 0x9e3779b185ebca87ull;
+        static const u64 c_hash_prime2  = 0xc2b2ae3d27d4eb4full;
+        static const u32 c_hash_prime32 = 0x9e3779b1u;
+        static const s32 c_hash_stripe  = 64;  // bytes
+        static const s32 c_hash_block   = 16;  // stripes between two scrambles of the lanes
+
+        typedef void (*hash_stripes_fn)(u64* acc, u8 const* ptr, s32 stripes);
+
+        // Every lane adds the 32x32-bit product of its (keyed) halves and the input of its neighbour
+#if defined(CSTRING_SIMD_SSE2)
+        static void s_hash_stripes_sse2(u64* acc, u8 const* ptr, s32 stripes)
+        {
+            __m128i a[4];
+            for (s32 i = 0; i < 4; ++i)
+                a[i] = _mm_loadu_si128((__m128i const*)(acc + i * 2));
+            for (s32 s = 0; s < stripes; ++s, ptr += c_hash_stripe)
+            {
+                for (s32 i = 0; i < 4; ++i)
+                {
+                    __m128i const d  = _mm_loadu_si128((__m128i const*)(ptr + i * 16));
+                    __m128i const dk = _mm_xor_si128(d, _mm_loadu_si128((__m128i const*)(c_hash_keys + i * 2)));
+                    __m128i const p  = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+                    a[i]             = _mm_add_epi64(a[i], _mm_add_epi64(p, _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+                }
+            }
+            for (s32 i = 0; i < 4; ++i)
+                _mm_storeu_si128((__m128i*)(acc + i * 2), a[i]);
+        }
+
+        CSTRING_TARGET_AVX2 static void s_hash_stripes_avx2(u64* acc, u8 const* ptr, s32 stripes)
+        {
+            __m256i a[2];
+            for (s32 i = 0; i < 2; ++i)
+                a[i] = _mm256_loadu_si256((__m256i const*)(acc + i * 4));
+            for (s32 s = 0; s < stripes; ++s, ptr += c_hash_stripe)
+            {
+                for (s32 i = 0; i < 2; ++i)
+                {
+                    __m256i const d  = _mm256_loadu_si256((__m256i const*)(ptr + i * 32));
+                    __m256i const dk = _mm256_xor_si256(d, _mm256_loadu_si256((__m256i const*)(c_hash_keys + i * 4)));
+                    __m256i const p  = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+                    a[i]             = _mm256_add_epi64(a[i], _mm256_add_epi64(p, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2))));
+                }
+            }
+            for (s32 i = 0; i < 2; ++i)
+                _mm256_storeu_si256((__m256i*)(acc + i * 4), a[i]);
+        }
+#elif defined(CSTRING_SIMD_NEON)
+        static void s_hash_stripes_neon(u64* acc, u8 const* ptr, s32 stripes)
+        {
+            uint64x2_t a[4];
+            for (s32 i = 0; i < 4; ++i)
+                a[i] = vld1q_u64(acc + i * 2);
+            for (s32 s = 0; s < stripes; ++s, ptr += c_hash_stripe)
+            {
+                for (s32 i = 0; i < 4; ++i)
+                {
+                    uint64x2_t const d  = vreinterpretq_u64_u8(vld1q_u8(ptr + i * 16));
+                    uint64x2_t const dk = veorq_u64(d, vld1q_u64(c_hash_keys + i * 2));
+                    uint64x2_t const p  = vmull_u32(vmovn_u64(dk), vshrn_n_u64(dk, 32));
+                    a[i]                = vaddq_u64(a[i], vaddq_u64(p, vextq_u64(d, d, 1)));
+                }
+            }
+            for (s32 i = 0; i < 4; ++i)
+                vst1q_u64(acc + i * 2, a[i]);
+        }
+#else
+        static void s_hash_stripes_scalar(u64* acc, u8 const* ptr, s32 stripes)
+        {
+            for (s32 s = 0; s < stripes; ++s, ptr += c_hash_stripe)
+            {
+                for (s32 i = 0; i < 8; ++i)
+                {
+                    u64 const d  = nsimd::load64(ptr + i * 8);
+                    u64 const dk = d ^ c_hash_keys[i];
+                    acc[i ^ 1] += d;
+                    acc[i] += (dk & 0xffffffffull) * (dk >> 32);
+                }
+            }
+        }
+#endif
+
+        static void s_hash_stripes_impl(u64* acc, u8 const* ptr, s32 stripes)
+        {
+            static hash_stripes_fn const s_fn = CSTRING_SIMD_SELECT(s_hash_stripes);
+            s_fn(acc, ptr, stripes);
+        }
+
+        static inline u64 s_hash_mix(u64 a, u64 b) { return nsimd::mul_fold64(a, b); }
+
+        static u64 s_hash_avalanche(u64 h)
+        {
+            h ^= h >> 37;
+            h *= 0x165667919e3779f9ull;
+            h ^= h >> 32;
+            return h;
+        }
+
+        static u64 s_hash_long(u8 const* ptr, s32 size)
+        {
+            u64 acc[8] = {c_hash_prime32, c_hash_prime1, c_hash_prime2, c_hash_keys[3], c_hash_keys[4], c_hash_prime2, c_hash_prime1, c_hash_prime32};
+
+            s32 stripes = (size - 1) / c_hash_stripe;  // the last stripe is read from the end of the input
+            while (stripes > 0)
+            {
+                s32 const n = stripes < c_hash_block ? stripes : c_hash_block;
+                s_hash_stripes_impl(acc, ptr, n);
+                ptr += n * c_hash_stripe;
+                size -= n * c_hash_stripe;
+                stripes -= n;
+                if (n == c_hash_block)
+                {
+                    for (s32 i = 0; i < 8; ++i)
+                        acc[i] = ((acc[i] ^ (acc[i] >> 47)) ^ c_hash_keys[7 - i]) * c_hash_prime32;
+                }
+            }
+            s_hash_stripes_impl(acc, ptr + size - c_hash_stripe, 1);
+
+            u64 h = 0;
+            for (s32 i = 0; i < 8; i += 2)
+                h += s_hash_mix(acc[i] ^ c_hash_keys[i], acc[i + 1] ^ c_hash_keys[i + 1]);
+            return h;
+        }
+
+        static u64 s_hash_runes(ucs2::pcrune str, s32 len)
+        {
+            u8 const* ptr  = (u8 const*)str;
+            s32 const size = len * (s32)sizeof(ucs2::rune);
+
+            u64 h = c_hash_prime1 * (u64)size;
+            if (size <= 16)
+            {
+                u64 a = 0, b = 0;
+                if (size >= 8)
+                {
+                    a = nsimd::load64(ptr);
+                    b = nsimd::load64(ptr + size - 8);
+                }
+                else if (size >= 4)
+                {
+                    a = nsimd::load32(ptr);
+                    b = nsimd::load32(ptr + size - 4);
+                }
+                else if (size > 0)
+                {
+                    a = str[0];
+                }
+                h ^= s_hash_mix(a ^ c_hash_keys[0], b ^ c_hash_keys[1]);
+            }
+            else if (size <= 128)
+            {
+                // 16-byte chunks from the front, the last chunk is read from the end of the input
+                s32 i = 0;
+                for (; i + 16 < size; i += 16)
+                    h += s_hash_mix(nsimd::load64(ptr + i) ^ c_hash_keys[(i >> 3) & 7], nsimd::load64(ptr + i + 8) ^ c_hash_keys[((i >> 3) + 1) & 7]);
+                h += s_hash_mix(nsimd::load64(ptr + size - 16) ^ c_hash_prime2, nsimd::load64(ptr + size - 8) ^ c_hash_prime1);
+            }
+            else
+            {
+                h += s_hash_long(ptr, size);
+            }
+            return s_hash_avalanche(h);
+        }
+
+        // The hash of all the runes of @data, cached until the data is modified (see s_make_writable)
+        static u64 s_data_hash(nstring::data_t* data)
+        {
+            if ((natomic::load(&data->m_flags) & c_data_hashed) != 0)
+                return data->m_hash;
+
+            u64 const              hash = s_hash_runes(data->m_ptr, data->m_len);
+            natomic::scoped_lock_t lock(&data->m_lock);
+            data->m_hash = hash;
+            natomic::store(&data->m_flags, (u16)(data->m_flags | c_data_hashed));
+            return hash;
+        }
+
+        //------------------------------------------------------------------------------
+        //------------ intern ----------------------------------------------------------
+        //------------------------------------------------------------------------------
+        // The intern table maps runes to a frozen data that is shared by all the strings interned with those
+        // runes, so two interned strings are equal when they have the same data. The table is an open addressing
+        // hash table with linear probing, it does not hold a reference, a data leaves the table with its last view.
+        struct intern_slot_t
+        {
+            nstring::data_t* m_data;  // nullptr when the slot is empty
+            u64              m_hash;
+        };
+
+        struct intern_table_t
+        {
+            intern_slot_t* m_slots;
+            s32            m_count;
+            s32            m_cap;   // power of two, at most half of the slots are used
+            u16            m_lock;  // taken by every lookup when CSTRING_THREAD_SAFE
+        };
+
+        static intern_table_t s_intern_table = {nullptr, 0, 0, 0};
+
+        static bool s_is_interned(nstring::instance_t const* v)
+        {
+            nstring::data_t const* data = v->m_data;
+            return (data->m_flags & c_data_interned) != 0 && v->m_range.m_from == 0 && v->m_range.m_to == data->m_len;
+        }
+
+        static void s_intern_grow(intern_table_t& table)
+        {
+            s32 const      cap   = table.m_cap == 0 ? 64 : table.m_cap * 2;
+            intern_slot_t* slots = (intern_slot_t*)nstring_memory::s_alloc_runes(cap * sizeof(intern_slot_t), nullptr);
+            for (s32 i = 0; i < cap; ++i)
+                slots[i].m_data = nullptr;
+
+            for (s32 i = 0; i < table.m_cap; ++i)
+            {
+                if (table.m_slots[i].m_data == nullptr)
+                    continue;
+                s32 slot = (s32)(table.m_slots[i].m_hash & (cap - 1));
+                while (slots[slot].m_data != nullptr)
+                    slot = (slot + 1) & (cap - 1);
+                slots[slot] = table.m_slots[i];
+            }
+
+            if (table.m_slots != nullptr)
+                nstring_memory::s_free_runes(table.m_slots, false);
+            table.m_slots = slots;
+            table.m_cap   = cap;
+        }
+
+        // Return the interned data holding the @len runes at @str, it is created when there is none yet
+        static nstring::data_t* s_intern_find(intern_table_t& table, ucs2::pcrune str, s32 len, u64 hash)
+        {
+            if ((table.m_count + 1) * 2 > table.m_cap)
+                s_intern_grow(table);
+
+            s32 slot = (s32)(hash & (table.m_cap - 1));
+            while (table.m_slots[slot].m_data != nullptr)
+            {
+                nstring::data_t* data = table.m_slots[slot].m_data;
+                if (table.m_slots[slot].m_hash == hash && data->m_len == len && s_equal_runes(data->m_ptr, str, len))
+                    return data;
+                slot = (slot + 1) & (table.m_cap - 1);
+            }
+
+            // The interned data outlives any arena scope
+            nstring::data_t* data = (nstring::data_t*)nstring_memory::s_alloc_object(sizeof(nstring::data_t), nullptr);
+            data->m_ptr           = (ucs2::prune)nstring_memory::s_alloc_runes((len + 1) * sizeof(ucs2::rune), nullptr);
+            data->m_head          = nullptr;
+            data->m_index         = nullptr;
+            data->m_log           = nullptr;
+            data->m_arena         = nullptr;
+            data->m_len           = len;
+            data->m_cap           = len;
+            data->m_ref           = 0;
+            data->m_hash          = hash;
+            data->m_flags         = c_data_frozen | c_data_interned | c_data_hashed;
+            data->m_lock          = 0;
+            nmem::memcpy(data->m_ptr, str, len * sizeof(ucs2::rune));
+            data->m_ptr[len] = '\0';
+
+            table.m_slots[slot].m_data = data;
+            table.m_slots[slot].m_hash = hash;
+            table.m_count++;
+            return data;
+        }
+
+        // Remove @data from the table, the entries after it that belong before it are shifted back so that
+        // no probe sequence is broken
+        static void s_intern_remove(intern_table_t& table, nstring::data_t* data)
+        {
+            s32 const mask = table.m_cap - 1;
+            s32       slot = (s32)(data->m_hash & mask);
+            while (table.m_slots[slot].m_data != data)
+                slot = (slot + 1) & mask;
+
+            for (s32 next = (slot + 1) & mask; table.m_slots[next].m_data != nullptr; next = (next + 1) & mask)
+            {
+                s32 const home = (s32)(table.m_slots[next].m_hash & mask);
+                if (((next - home) & mask) >= ((next - slot) & mask))
+                {
+                    table.m_slots[slot] = table.m_slots[next];
+                    slot                = next;
+                }
+            }
+            table.m_slots[slot].m_data = nullptr;
+
+            if (--table.m_count == 0)
+            {
+                nstring_memory::s_free_runes(table.m_slots, false);
+                table.m_slots = nullptr;
+                table.m_cap   = 0;
+            }
+        }
+
+        // The reference count of interned data drops under the lock of the table, so a lookup never finds a
+        // data that is being released
+        static nstring::data_t* s_intern_detach(nstring::data_t* data)
         {
-            // Return where 'rhs' is in relation to 'lhs'
-            // --------| lhs |--------[ rhs ]--------        RIGHT
-            // --------[ rhs ]--------| lhs |--------        LEFT
-            // --------[ rhs ]          lhs |--------        LEFT INSIDE
-            // --------|     lhs      [ rhs ]--------        RIGHT INSIDE
-            // --------|    [ rhs ]     lhs |--------        INSIDE
-            // --------[     rhs  lhs       ]--------        MATCH
-            // --------[ rhs    |    ]  lhs |--------        LEFT OVERLAP
-            // --------| lhs    [    |  rhs ]--------        RIGHT OVERLAP
-            // --------[    | lhs |     rhs ]--------        ENVELOPE
-            // --------[ lhs |          rhs ]--------        LEFT ENVELOPE
-            // --------[ rhs         |  lhs ]--------        RIGHT ENVELOPE
-            if (lhs_to <= rhs_from)
-                return RIGHT;
-            else if (lhs_from >= rhs_to)
-                return LEFT;
-            else if (lhs_from == rhs_from && lhs_to > rhs_to)
-                return LEFT | INSIDE;
-            else if (lhs_from < rhs_from && lhs_to == rhs_to)
-                return RIGHT | INSIDE;
-            else if (lhs_from < rhs_from && lhs_to > rhs_to)
-                return INSIDE;
-            else if (lhs_from == rhs_from && lhs_to == rhs_to)
-                return MATCH;
-            else if (rhs_from < lhs_from && rhs_to < lhs_to)
-                return LEFT | OVERLAP;
-            else if (rhs_from > lhs_from && rhs_to > lhs_to)
-                return RIGHT | OVERLAP;
-            else if (lhs_from == rhs_from && lhs_to < rhs_to)
-                return LEFT | ENVELOPE;
-            else if (rhs_from < lhs_from && lhs_to == rhs_to)
-                return RIGHT | ENVELOPE;
-            else if (rhs_from < lhs_from && rhs_to > lhs_to)
-                return ENVELOPE;
-            return NONE;
+            {
+                natomic::scoped_lock_t lock(&s_intern_table.m_lock);
+                if (natomic::dec(&data->m_ref) != 0)
+                    return data;
+                s_intern_remove(s_intern_table, data);
+            }
+            nstring_memory::s_free_runes(data->m_ptr, false);
+            nstring_memory::s_free_object(data, false);
+            return s_get_default_data();
         }
 
-        static inline s32 s_compute_range_overlap(s32 lhs_from, s32 lhs_to, s32 rhs_from, s32 rhs_to)
+        // Make @v a view of the interned data with the same runes, its own data is released
+        static void s_intern(nstring::instance_t* v)
         {
-            if (rhs_from < lhs_from && rhs_to < lhs_to)
-                return rhs_to - lhs_from;
-            else if (rhs_from > lhs_from && rhs_to > lhs_to)
-                return lhs_to - rhs_from;
-            return 0;
+            if (s_is_default_instance(v) || s_is_interned(v))
+                return;
+            if (v->is_empty())
+            {
+                v->invalidate();
+                return;
+            }
+
+            nstring::data_t* data = v->m_data;
+            ucs2::pcrune     str  = data->m_ptr + v->m_range.m_from;
+            s32 const        len  = v->size();
+            u64 const        hash = s_hash_runes(str, len);
+
+            nstring::data_t* interned;
+            {
+                natomic::scoped_lock_t lock(&s_intern_table.m_lock);
+                interned = s_intern_find(s_intern_table, str, len, hash)->attach();
+            }
+
+            s_untrack(v);
+            data->detach();
+            v->m_data  = interned;
+            v->m_range = {0, len};
+            v->m_slot  = -1;
+            s_track(v);
         }
 
-        // When the string is modified views can become invalid, here we try to keep them
-        // 'correct' as much as we can. For example when we insert text into the string we
-        // can correct all of the existing views.
-        // Removal of text from a string may invalidate views that intersect with the range
-        // of text that is removed.
-        // Clear and Reset will invalidate all views on the string.
-        static void s_adjust_active_view(nstring::instance_t* v, s32 op_code, s32 rhs_from, s32 rhs_to)
+        // Visit the views in the slots [0, @end) that end at or after @pos, @visit receives the view with
+        // its range up to date and may change it. A view that has its start moved (e.g. a view starting at
+        // an insertion, or invalidated) moves back to the list of active views since it may no longer fit
+        // in the order of the slots.
+        template <typename V> static void s_index_visit(nstring::data_t* data, s32 node, s32 lo, s32 hi, s32 end, s32 shift, s32 pos, V const& visit)
         {
-            s32& lhs_from = v->m_range.m_from;
-            s32& lhs_to   = v->m_range.m_to;
+            view_index_t* index = data->m_index;
+            if (lo >= end || index->m_max_to[node] + shift < pos)
+                return;
 
-            switch (op_code)
+            if (node >= index->m_size)
             {
-                case REMOVAL:
+                instance_t* v    = index->m_views[lo];
+                s32 const   from = index->m_from[lo] + shift;
+                v->m_range       = {from, index->m_to[lo] + shift};
+                visit(v);
+                if (v->m_range.m_from != from)
                 {
-                    // --------| lhs |--------[ rhs ]--------        RIGHT = NOTHING
-                    // --------[ rhs ]--------| lhs |--------        LEFT = SHIFT LEFT rhs.size()
-                    // --------|    [ rhs ]     lhs |--------        INSIDE = NARROW RIGHT by rhs.size()
-                    // --------[ rhs ]          lhs |--------        LEFT INSIDE = NARROW RIGHT by rhs.size()
-                    // --------|     lhs      [ rhs ]--------        RIGHT INSIDE = NARROW RIGHT by rhs.size()
-                    // --------[     rhs  lhs       ]--------        MATCH = INVALIDATE
-                    // --------[ rhs    |    ]  lhs |--------        LEFT OVERLAP = NARROW LEFT by overlap & SHIFT LEFT by rhs.size()-overlap
-                    // --------| lhs    [    |  rhs ]--------        RIGHT OVERLAP = NARROW RIGHT by overlap
-                    // --------[    | lhs |     rhs ]--------        ENVELOPE = INVALIDATE
-                    // --------[ lhs |          rhs ]--------        LEFT ENVELOPE = INVALIDATE
-                    // --------[ rhs         |  lhs ]--------        RIGHT ENVELOPE = INVALIDATE
-                    s32 const c = s_compare(lhs_from, lhs_to, rhs_from, rhs_to);
-                    switch (c)
-                    {
-                        case LEFT:
-                            lhs_from -= (rhs_to - rhs_from);
-                            lhs_to -= (rhs_to - rhs_from);
-                            break;
-                        case INSIDE:
-                        case LEFT | INSIDE:
-                        case RIGHT | INSIDE: lhs_to -= (rhs_to - rhs_from); break;
-                        case MATCH:
-                        case ENVELOPE:
-                        case LEFT | ENVELOPE:
-                        case RIGHT | ENVELOPE: lhs_from = lhs_to = 0; break;
-                        case LEFT | OVERLAP:
-                        {
-                            s32 const overlap = s_compute_range_overlap(lhs_from, lhs_to, rhs_from, rhs_to);
-                            lhs_from += overlap;
-                            lhs_to -= ((rhs_to - rhs_from) - overlap);
-                            lhs_from -= ((rhs_to - rhs_from) - overlap);
-                        }
+                    index->m_views[lo] = nullptr;
+                    index->m_parked--;
+                    v->m_slot = -1;
+                    data->addToList(v);
+                }
+                else
+                {
+                    index->m_from[lo] = v->m_range.m_from - shift;
+                    index->m_to[lo]   = v->m_range.m_to - shift;
+                }
+                s_index_set_leaf(index, lo);
+                return;
+            }
+
+            shift += index->m_shift[node];
+            s32 const mid = (lo + hi) >> 1;
+            s_index_visit(data, node * 2, lo, mid, end, shift, pos, visit);
+            s_index_visit(data, node * 2 + 1, mid, hi, end, shift, pos, visit);
+            s_index_pull(index, node);
+        }
+
+        // An edit replaced [@from, @to) and changed the length by @shift, the views that start after @to
+        // are shifted and the ones that end at or after @from are passed to @visit.
+        template <typename V> static void s_index_edit(nstring::data_t* data, s32 from, s32 to, s32 shift, V const& visit)
+        {
+            view_index_t* index = data->m_index;
+            s32 const     split = s_index_first_after(index, to);
+            s_index_shift(index, split, index->m_used, shift);
+            s_index_visit(data, 1, 0, index->m_size, split, 0, from, visit);
+            if (index->m_parked == 0)
+                s_index_release(data);
+        }
+
+        // Heap sort @views on their m_from
+        static void s_sort_views(instance_t** views, s32 count)
+        {
+            for (s32 start = count / 2 - 1, end = count; end > 1;)
+            {
+                s32 root;
+                if (start >= 0)
+                {
+                    root = start--;
+                }
+                else
+                {
+                    --end;
+                    instance_t* t = views[0];
+                    views[0]      = views[end];
+                    views[end]    = t;
+                    root          = 0;
+                }
+                while (root * 2 + 1 < end)
+                {
+                    s32 child = root * 2 + 1;
+                    if (child + 1 < end && views[child + 1]->m_range.m_from > views[child]->m_range.m_from)
+                        ++child;
+                    if (views[root]->m_range.m_from >= views[child]->m_range.m_from)
                         break;
-                        case RIGHT | OVERLAP: lhs_to -= s_compute_range_overlap(lhs_from, lhs_to, rhs_from, rhs_to); break;
-                        case RIGHT: break;
-                    }
+                    instance_t* t = views[root];
+                    views[root]   = views[child];
+                    views[child]  = t;
+                    root          = child;
                 }
-                break;
+            }
+        }
 
-                case INSERTION:
+        // Move all the active views of @str except @str itself into the index, this rebuilds the index
+        static void s_park_views(nstring::instance_t* str, s32 active)
+        {
+            nstring::data_t* data   = str->m_data;
+            view_index_t*    old    = data->m_index;
+            s32 const        parked = old != nullptr ? old->m_parked : 0;
+            if (active <= c_view_index_min_active || active * active <= parked)
+                return;
+
+            // Collect the active views in order of m_from, views that were invalidated by the edit have
+            // been moved back to the list so it can hold more than @active views
+            s_log_flush(data);
+            s32 count = 0;
+            for (instance_t* iter = str->m_next; iter != str; iter = iter->m_next)
+                ++count;
+            instance_t** views = (instance_t**)nstring_memory::s_string_alloc->allocate(count * sizeof(instance_t*));
+            s32          n     = 0;
+            for (instance_t* iter = str->m_next; iter != str; iter = iter->m_next)
+                views[n++] = iter;
+            s_sort_views(views, count);
+            str->m_next = str->m_prev = str;
+            data->m_head              = str;
+            if (data->m_log != nullptr)
+                data->m_log->m_active = data->m_log->m_current = 1;
+
+            // Push the pending shifts of the old index down to the slots
+            if (old != nullptr)
+            {
+                for (s32 node = 1; node < old->m_size; ++node)
                 {
-                    // Insertion happens at rhs.from
-                    // --------| lhs |--------[ rhs ]--------        RIGHT = DO NOTHING
-                    // --------[     rhs  lhs       ]--------        MATCH = SHIFT RIGHT by rhs.size()
-                    // --------[ rhs ]--------| lhs |--------        LEFT = SHIFT RIGHT by rhs.size()
-                    // --------[    | lhs |     rhs ]--------        ENVELOPE = SHIFT RIGHT by rhs.size()
-                    // --------[ lhs |          rhs ]--------        LEFT ENVELOPE = SHIFT RIGHT by rhs.size()
-                    // --------[ rhs         |  lhs ]--------        RIGHT ENVELOPE = SHIFT RIGHT by rhs.size()
-                    // --------[ rhs    |    ]  lhs |--------        LEFT OVERLAP = SHIFT RIGHT by rhs.size()
-                    // --------[ rhs ]          lhs |--------        LEFT INSIDE = SHIFT RIGHT by rhs.size()
-                    // --------|    [ rhs ]     lhs |--------        INSIDE = EXTEND RIGHT by rhs.size()
-                    // --------|     lhs      [ rhs ]--------        RIGHT INSIDE = EXTEND RIGHT by rhs.size()
-                    // --------| lhs    [    |  rhs ]--------        RIGHT OVERLAP = EXTEND RIGHT by rhs.size()
-                    s32 const c = s_compare(lhs_from, lhs_to, rhs_from, rhs_to);
-                    switch (c)
-                    {
-                        case RIGHT: break;
-                        case MATCH:
-                        case LEFT:
-                        case ENVELOPE:
-                        case (LEFT | ENVELOPE):
-                        case (RIGHT | ENVELOPE):
-                        case (LEFT | OVERLAP):
-                        case (LEFT | INSIDE):
-                            lhs_to += (rhs_to - rhs_from);
-                            lhs_from += (rhs_to - rhs_from);
-                            break;
-                        case INSIDE:
-                        case (RIGHT | INSIDE):
-                        case (RIGHT | OVERLAP): lhs_to += (rhs_to - rhs_from); break;
-                    }
+                    s_index_apply(old, node * 2, old->m_shift[node]);
+                    s_index_apply(old, node * 2 + 1, old->m_shift[node]);
+                    old->m_shift[node] = 0;
                 }
-                break;
+            }
 
-                case CLEARED:
-                case RELEASED:
+            // Merge the old slots and the active views into the new index
+            view_index_t* index = s_index_alloc(data, parked + count);
+            s32           i     = 0;
+            s32           j     = 0;
+            s32           slot  = 0;
+            while (true)
+            {
+                while (old != nullptr && i < old->m_used && old->m_views[i] == nullptr)
+                    ++i;
+                bool const from_old = old != nullptr && i < old->m_used;
+                if (!from_old && j == count)
+                    break;
+                if (from_old && (j == count || old->m_from[i] <= views[j]->m_range.m_from))
                 {
-                    lhs_from = lhs_to = 0;
+                    index->m_views[slot] = old->m_views[i];
+                    index->m_from[slot]  = old->m_from[i];
+                    index->m_to[slot]    = old->m_to[i];
+                    ++i;
                 }
-                break;
+                else
+                {
+                    index->m_views[slot] = views[j];
+                    index->m_from[slot]  = views[j]->m_range.m_from;
+                    index->m_to[slot]    = views[j]->m_range.m_to;
+                    ++j;
+                }
+                index->m_views[slot]->m_slot = slot;
+                ++slot;
+            }
+            index->m_used   = slot;
+            index->m_parked = slot;
+            for (; slot < index->m_size; ++slot)
+                index->m_views[slot] = nullptr;
+
+            // Build the tree bottom up
+            for (s32 s = 0; s < index->m_size; ++s)
+                s_index_set_leaf(index, s);
+            for (s32 node = index->m_size - 1; node >= 1; --node)
+            {
+                index->m_shift[node] = 0;
+                s_index_pull(index, node);
             }
+
+            nstring_memory::s_string_alloc->deallocate(views);
+            if (old != nullptr)
+                nstring_memory::s_free_runes(old, s_in_arena(data));
+            data->m_index = index;
         }
 
+        struct adjust_view_t
+        {
+            s32         m_op_code;
+            s32         m_from;
+            s32         m_to;
+            inline void operator()(nstring::instance_t* v) const { s_adjust_active_view(v, m_op_code, m_from, m_to); }
+        };
+
+        // Only @list, the view making the edit, is adjusted here. The other active views catch up through
+        // the edit log when they are used and the parked views are adjusted through the index.
         static void s_adjust_active_views(nstring::instance_t* list, s32 op_code, s32 op_range_from, s32 op_range_to)
         {
-            nstring::instance_t* iter = list;
-            do
+            s_adjust_active_view(list, op_code, op_range_from, op_range_to);
+            if (list->m_next != list)
+                s_log_edit(list, op_code, op_range_from, op_range_to);
+
+            if (list->m_data->m_index != nullptr)
             {
-                s_adjust_active_view(iter, op_code, op_range_from, op_range_to);
-                iter = iter->m_next;
-            } while (iter != list);
+                adjust_view_t const visit = {op_code, op_range_from, op_range_to};
+                if (op_code == REMOVAL)
+                    s_index_edit(list->m_data, op_range_from, op_range_to, op_range_from - op_range_to, visit);
+                else if (op_code == INSERTION)
+                    s_index_edit(list->m_data, op_range_from, op_range_from, op_range_to - op_range_from, visit);
+                else
+                    s_index_edit(list->m_data, c_view_index_dead, list->m_data->m_len, 0, visit);
+            }
+            s_park_views(list, list->m_data->m_log != nullptr ? list->m_data->m_log->m_active : 1);
         }
 
         //------------------------------------------------------------------------------
@@ -630,19 +3577,32 @@ namespace ncore
         //------------------------------------------------------------------------------
         nstring::data_t* nstring::data_t::detach()
         {
-            if (m_ref == 1)
+            if (s_is_default_data(this))
+                return this;
+            if ((m_flags & c_data_interned) != 0)
+                return s_intern_detach(this);
+
+            if (natomic::dec(&m_ref) == 0)
             {
-                if (s_is_default_data(this))
-                    return this;
+                if (m_index != nullptr)
+                    s_index_release(this);
+                if (m_log != nullptr)
+                    nstring_memory::s_free_runes(m_log, s_in_arena(this));
+                if ((m_flags & c_data_pieces) != 0)
+                    s_pieces_release(this);
+
+                if (is_embedded())
+                {
+                    // The data is part of the allocation of its instance, only the runes may live on the heap
+                    if (!is_inline())
+                        nstring_memory::s_free_runes(m_ptr, s_in_arena(this));
+                    return s_get_default_data();
+                }
 
-                nstring_memory::s_string_alloc->deallocate(m_ptr);
-                nstring_memory::s_object_alloc->deallocate(this);
+                nstring_memory::s_free_runes(m_ptr, s_in_arena(this));
+                nstring_memory::s_free_object(this, s_in_arena(this));
                 return s_get_default_data();
             }
-            else if (m_ref > 0)
-            {
-                m_ref--;
-            }
             return this;
         }
 
@@ -651,36 +3611,91 @@ namespace ncore
         //------------------------------------------------------------------------------
         nstring::instance_t* nstring::instance_t::clone_full() const
         {
-            s32 const        strlen = m_range.size();
-            nstring::data_t* data;
+            s32 const strlen = m_range.size();
             if (s_is_default_data(m_data))
             {
-                data = m_data->attach();
+                return s_alloc_instance({0, strlen}, m_data);
             }
-            else
+            else if (strlen <= c_sso_max_len)
             {
-                data = s_unique_data(m_data, m_range.m_from, m_range.m_to);
+                nstring::instance_t* v   = s_alloc_string(strlen);
+                ucs2::pcrune         src = m_data->m_ptr + m_range.m_from;
+                ucs2::prune          dst = v->m_data->m_ptr;
+                for (s32 i = 0; i < strlen; i++)
+                    dst[i] = src[i];
+                return v;
             }
-            nstring::instance_t* v = s_alloc_instance({0, strlen}, data);
+
+            nstring::data_t*     data = s_unique_data(m_data, m_range.m_from, m_range.m_to, nstring_memory::s_arena);
+            nstring::instance_t* v    = s_alloc_instance({0, strlen}, data);
             return v;
         }
 
-        nstring::instance_t* nstring::instance_t::clone_slice() const
+        nstring::instance_t* nstring::instance_t::clone_slice()
         {
-            nstring::instance_t* v = s_alloc_instance(m_range, m_data);
+            nstring::instance_t* v = s_alloc_instance(m_range, share());
             return v;
         }
 
+        // Return the data of this instance so that it can be shared with other instances, a small
+        // string has its data embedded in this instance and here it is moved into its own allocation.
+        nstring::data_t* nstring::instance_t::share()
+        {
+            // A view taken from a clone views the runes of that clone
+            if (m_slot == c_slot_clone)
+                s_make_writable(this);
+
+            if (m_data->is_embedded())
+            {
+                // Slices of the same small string may be taken from different threads, only one moves the data
+                nstring::data_t*       old = m_data;
+                natomic::scoped_lock_t lock(&old->m_lock);
+                if (m_data != old)
+                    return m_data;
+
+                nstring_memory::arena_scope_t* arena = old->m_arena;
+                nstring::data_t*               data  = (nstring::data_t*)nstring_memory::s_alloc_object(sizeof(nstring::data_t), arena);
+                data->m_head          = nullptr;
+                data->m_index         = nullptr;
+                data->m_log           = nullptr;
+                data->m_arena         = arena;
+                data->m_pieces        = nullptr;
+                data->m_len           = old->m_len;
+                data->m_ref           = 0;
+                data->m_flags         = 0;
+                data->m_lock          = 0;
+                if (old->is_inline())
+                {
+                    data->m_ptr = (ucs2::prune)nstring_memory::s_alloc_runes((old->m_len + 1) * sizeof(ucs2::rune), arena);
+                    data->m_cap = old->m_len;
+                    nmem::memcpy(data->m_ptr, old->m_ptr, (old->m_len + 1) * sizeof(ucs2::rune));
+                }
+                else
+                {
+                    data->m_ptr = old->m_ptr;
+                    data->m_cap = old->m_cap;
+                }
+
+                old->remFromList(this);
+                old->m_ref = 0;
+                old->m_ptr = (ucs2::prune)(old + 1);
+
+                m_data = data->attach();
+                m_data->addToList(this);
+            }
+            return m_data;
+        }
+
         nstring::instance_t* nstring::instance_t::release()
         {
             if (!s_is_default_instance(this))
             {
                 if (!s_is_default_data(m_data))
                 {
-                    m_data->remFromList(this);
+                    s_untrack(this);
                     m_data->detach();
                 }
-                nstring_memory::s_object_alloc->deallocate(this);
+                nstring_memory::s_free_object(this, s_in_arena(this));
             }
             return s_get_default_instance();
         }
@@ -689,11 +3704,12 @@ namespace ncore
         {
             if (!s_is_default_data(m_data))
             {
-                m_data->remFromList(this);
+                s_untrack(this);
                 m_data->detach();
                 m_data = s_get_default_data();
             }
             m_range = {0, 0};
+            m_slot  = -1;
         }
 
         //------------------------------------------------------------------------------
@@ -705,83 +3721,68 @@ namespace ncore
         static nstring::range_t selectAfterLocal(const nstring::instance_t* str, const nstring::instance_t* sel) { return {sel->m_range.m_to - str->m_range.m_from, str->m_range.m_to - str->m_range.m_from}; }
         static nstring::range_t selectAfterIncludedLocal(const nstring::instance_t* str, const nstring::instance_t* sel) { return {sel->m_range.m_from - str->m_range.m_from, str->m_range.m_to - str->m_range.m_from}; }
 
+        // Compare the (local) view @lhsview on @lhs with @rhs in lexicographic order of the runes, a string
+        // that is a prefix of the other comes first
         static s32 compare(const nstring::instance_t* lhs, nstring::range_t const& lhsview, const nstring::instance_t* rhs)
         {
-            ASSERT(lhsview.is_inside(lhs->m_range));
-
-            if (lhsview.size() < rhs->size())
-                return -1;
-            if (lhsview.size() > rhs->size())
-                return 1;
-            ucs2::pcrune lhsdata = lhs->m_data->m_ptr + lhs->m_range.m_from + lhsview.m_from;
-            ucs2::pcrune rhsdata = rhs->m_data->m_ptr + rhs->m_range.m_from;
-            ucs2::pcrune lhsend  = lhsdata + lhsview.size();
-            while (lhsdata < lhsend)
+            ASSERT(lhsview.m_from >= 0 && lhsview.m_to <= lhs->size());
+
+            read_lock_t const lock(lhs->m_data, rhs->m_data);
+            s32 const         lhsfrom = lhs->m_range.m_from + lhsview.m_from;
+            s32 const         rhsfrom = rhs->m_range.m_from;
+            s32 const         len     = math::min(lhsview.size(), rhs->size());
+            s32 const         i       = s_mismatch_in_data(lhs->m_data, lhsfrom, rhs->m_data, rhsfrom, len);
+            if (i < len)
             {
-                ucs2::rune const lc = *lhsdata++;
-                ucs2::rune const rc = *rhsdata++;
-                if (lc != rc)
-                    return (lc < rc) ? -1 : 1;
+                run_t const lhsrun = s_data_run(lhs->m_data, lhsfrom + i);
+                run_t const rhsrun = s_data_run(rhs->m_data, rhsfrom + i);
+                return (lhsrun.m_ptr[lhsfrom + i - lhsrun.m_from] < rhsrun.m_ptr[rhsfrom + i - rhsrun.m_from]) ? -1 : 1;
             }
-            return 0;
+            if (lhsview.size() == rhs->size())
+                return 0;
+            return (lhsview.size() < rhs->size()) ? -1 : 1;
         }
 
-        static bool isEqual(const nstring::instance_t* lhs, nstring::range_t const& lhsview, const nstring::instance_t* rhs) { return compare(lhs, lhsview, rhs) == 0; }
+        // Equality only, strings of a different size are rejected before any rune is read
+        static bool isEqual(const nstring::instance_t* lhs, nstring::range_t const& lhsview, const nstring::instance_t* rhs)
+        {
+            ASSERT(lhsview.m_from >= 0 && lhsview.m_to <= lhs->size());
+
+            s32 const len = lhsview.size();
+            if (len != rhs->size())
+                return false;
+            read_lock_t const lock(lhs->m_data, rhs->m_data);
+            return s_mismatch_in_data(lhs->m_data, lhs->m_range.m_from + lhsview.m_from, rhs->m_data, rhs->m_range.m_from, len) == len;
+        }
 
         static nstring::range_t findCharUntil(const nstring::instance_t* str, uchar32 find)
         {
-            ucs2::pcrune strdata = str->m_data->m_ptr + str->m_range.m_from;
-            for (s32 i = 0; i < str->size(); i++)
-            {
-                uchar32 const c = strdata[i];
-                if (c == find)
-                {
-                    return {0, i};
-                }
-            }
+            match_rune_t const match = {find};
+            s32 const          i     = s_find_rune(str, match);
+            if (i >= 0)
+                return {0, i};
             return {0, 0};
         }
 
         static nstring::range_t findStrUntil(const nstring::instance_t* str, const nstring::instance_t* find)
         {
-            nstring::range_t view  = {0, find->size()};
-            s32 const        count = s_move_view_right_count(str, view);
-            for (s32 m = 0; m < count; m++)
-            {
-                if (nstring::isEqual(str, view, find))
-                    return {0, view.m_from};
-                view.move_right();
-            }
-            return {0, 0};
+            nstring::range_t const view = s_find(str, find);
+            return {0, view.m_from};
         }
 
         static nstring::range_t findCharUntilLast(const nstring::instance_t* str, uchar32 find)
         {
-            ucs2::pcrune strdata = str->m_data->m_ptr + str->m_range.m_from;
-            for (s32 i = str->size() - 1; i >= 0; --i)
-            {
-                uchar32 const c = strdata[i];
-                if (c == find)
-                {
-                    return {str->m_range.m_from, str->m_range.m_from + i};
-                }
-            }
+            match_rune_t const match = {find};
+            s32 const          i     = s_find_last_rune(str, match);
+            if (i >= 0)
+                return {str->m_range.m_from, str->m_range.m_from + i};
             return {0, 0};
         }
 
         static nstring::range_t findStrUntilLast(const nstring::instance_t* str, const nstring::instance_t* find)
         {
-            nstring::range_t view = {0, 0};
-            view.m_from           = str->size() - find->size();
-            view.m_to             = str->size();
-            s32 const count       = s_move_view_left_count(str, view);
-            for (s32 m = 0; m < count; m++)
-            {
-                if (isEqual(str, view, find))
-                    return {0, view.m_from};
-                view.move_left();
-            }
-            return {0, 0};
+            nstring::range_t const view = s_find_last(str, find);
+            return {0, view.m_from};
         }
 
         static void toAscii(const nstring::instance_t* str, char* dst, s32 dstMaxLen)
@@ -806,8 +3807,27 @@ namespace ncore
     //------------------------------------------------------------------------------
     //------------------------------------------------------------------------------
 
+    // The instance of this string with its range up to date, the runes of a string that is being
+    // edited may not be contiguous so only use this when the runes are not read.
+    inline nstring::instance_t* string_t::range_item() const
+    {
+        nstring::s_sync(m_item);
+        return m_item;
+    }
+
+    // The instance of this string with its range up to date and its runes contiguous
+    inline nstring::instance_t* string_t::item() const
+    {
+        nstring::instance_t* v = range_item();
+        if ((natomic::load(&v->m_data->m_flags) & nstring::c_data_flatten) != 0)
+            nstring::s_flatten(v->m_data);
+        return v;
+    }
+
     string_t::string_t() { m_item = nstring::s_get_default_instance(); }
 
+    string_t::string_t(const char* utf8, s32 len) { m_item = nstring::s_alloc_utf8(utf8, len); }
+
     string_t::string_t(const char* str)
     {
         ascii::pcrune end;
@@ -815,10 +3835,8 @@ namespace ncore
 
         if (byteslen > 0)
         {
-            nstring::data_t*       data  = nstring::s_alloc_data((byteslen + 1) * sizeof(uchar16));
-            nstring::range_t const range = {0, byteslen};
-            m_item                       = nstring::s_alloc_instance(range, data);
-            ucs2::prune dst              = data->m_ptr;
+            m_item          = nstring::s_alloc_string(byteslen);
+            ucs2::prune dst = m_item->m_data->m_ptr;
             while (*str != '\0')
             {
                 *dst = *str++;
@@ -839,8 +3857,10 @@ namespace ncore
 
         if (strlen > 0)
         {
-            nstring::data_t* data = nstring::s_alloc_data(strlen);
-            m_item                = nstring::s_alloc_instance({0, 0}, data);
+            m_item                   = nstring::s_alloc_string(strlen);
+            m_item->m_range          = {0, 0};
+            m_item->m_data->m_len    = 0;
+            m_item->m_data->m_ptr[0] = '\0';
         }
         else
         {
@@ -848,25 +3868,32 @@ namespace ncore
         }
     }
 
-    string_t::string_t(const string_t& other) { m_item = other.m_item->clone_full(); }
+    string_t::string_t(const string_t& other) { m_item = nstring::s_clone(other.item()); }
+
+    // Moving only transfers the instance, the instance itself stays at the same address so
+    // its links in the view list of 'data_t' remain valid and the runes are not touched.
+    string_t::string_t(string_t&& other)
+        : m_item(other.m_item)
+    {
+        other.m_item = nstring::s_get_default_instance();
+    }
 
     string_t::string_t(const string_t& left, const string_t& right)
     {
         const s32 strlen = left.size() + right.size();
 
-        nstring::data_t* data = nstring::s_alloc_data(strlen);
-        m_item                = nstring::s_alloc_instance({0, strlen}, data);
+        m_item = nstring::s_alloc_string(strlen);
 
         // manually copy the left and right strings into the new string
-        ucs2::prune src = left.m_item->m_data->m_ptr + left.m_item->m_range.m_from;
-        ucs2::prune dst = m_item->m_data->m_ptr;
+        ucs2::prune src = left.item()->m_data->m_ptr + left.item()->m_range.m_from;
+        ucs2::prune dst = item()->m_data->m_ptr;
         for (s32 i = 0; i < left.size(); i++)
             *dst++ = *src++;
-        src = right.m_item->m_data->m_ptr + right.m_item->m_range.m_from;
+        src = right.item()->m_data->m_ptr + right.item()->m_range.m_from;
         for (s32 i = 0; i < right.size(); i++)
             *dst++ = *src++;
 
-        m_item->m_range.m_to = strlen;
+        item()->m_range.m_to = strlen;
     }
 
     string_t::string_t(nstring::instance_t* instance, s32 weird) { m_item = instance; }
@@ -874,41 +3901,100 @@ namespace ncore
     string_t::string_t(nstring::instance_t* instance, s32 from, s32 to, s32 weird)
     {
         m_item = instance;
-        m_item->m_range.m_from += from;
-        m_item->m_range.m_to = m_item->m_range.m_from + (to - from);
+        item()->m_range.m_from += from;
+        item()->m_range.m_to = item()->m_range.m_from + (to - from);
     }
 
     string_t::~string_t() { release(); }
 
-    //------------------------------------------------------------------------------
-    //------------------------------------------------------------------------------
-    s32      string_t::size() const { return m_item->size(); }
-    s32      string_t::cap() const { return m_item->cap(); }
-    bool     string_t::is_empty() const { return m_item->is_empty(); }
-    bool     string_t::is_slice() const { return m_item->is_slice(); }
+    //------------------------------------------------------------------------------
+    //------------------------------------------------------------------------------
+    s32      string_t::size() const { return range_item()->size(); }
+    s32      string_t::cap() const { return item()->cap(); }
+
+    void string_t::promote()
+    {
+        if (!nstring::s_in_arena(item()) && !nstring::s_in_arena(item()->m_data))
+            return;
+
+        // Clone the string with the arena disabled so that the copy is allocated from the heap
+        nstring_memory::arena_scope_t* arena = nstring_memory::s_arena;
+        nstring_memory::s_arena              = nullptr;
+        nstring::instance_t* copy            = item()->clone_full();
+        nstring_memory::s_arena              = arena;
+
+        release();
+        m_item = copy;
+    }
+
+    void string_t::reserve(s32 len)
+    {
+        make_writable();
+        if (nstring::s_is_default_instance(item()))
+        {
+            m_item                   = nstring::s_alloc_string(len);
+            item()->m_range          = {0, 0};
+            item()->m_data->m_len    = 0;
+            item()->m_data->m_ptr[0] = '\0';
+            return;
+        }
+        s32 const new_cap = item()->m_data->m_len + (len - size());
+        if (new_cap > item()->m_data->m_cap)
+            nstring::s_realloc_data(item()->m_data, new_cap);
+    }
+
+    void string_t::shrink_to_fit()
+    {
+        make_writable();
+        nstring::data_t* data = item()->m_data;
+        if (!nstring::s_is_default_data(data) && data->m_cap > data->m_len)
+            nstring::s_realloc_data(data, data->m_len);
+    }
+
+    bool     string_t::is_empty() const { return range_item()->is_empty(); }
+    bool     string_t::is_slice() const { return range_item()->is_slice(); }
+    bool     string_t::is_frozen() const { return (range_item()->m_data->m_flags & nstring::c_data_frozen) != 0; }
+    void     string_t::freeze() { nstring::s_freeze(item()); }
+    bool     string_t::is_interned() const { return nstring::s_is_interned(range_item()); }
+    u64      string_t::hash() const
+    {
+        // A view of all the runes uses the hash cached on the data, a slice hashes its own range
+        nstring::instance_t* v = item();
+        if (!nstring::s_is_default_data(v->m_data) && v->m_range.m_from == 0 && v->m_range.m_to == v->m_data->m_len)
+            return nstring::s_data_hash(v->m_data);
+        return nstring::s_hash_runes(v->m_data->m_ptr + v->m_range.m_from, v->size());
+    }
+    void     string_t::intern() { nstring::s_intern(item()); }
+    s32      string_t::make_writable() { return nstring::s_make_writable(range_item()); }
     void     string_t::clear() { release(); }
     string_t string_t::slice() const
     {
-        nstring::instance_t* item = m_item->clone_slice();
-        return string_t(item, m_item->m_range.m_from, m_item->m_range.m_to, 8888);
+        nstring::instance_t* slice = range_item()->clone_slice();
+        return string_t(slice, m_item->m_range.m_from, m_item->m_range.m_to, 8888);
     }
-    string_t string_t::clone() const { return string_t(m_item->clone_full(), 8888); }
+    string_t string_t::clone() const { return string_t(nstring::s_clone(item()), 8888); }
 
     string_t string_t::operator()(s32 _from, s32 _to) const
     {
         math::sort(_from, _to);
-        const u32            from = math::min(m_item->m_range.m_from + _from, m_item->m_range.m_to);
-        const u32            to   = math::min(m_item->m_range.m_from + _to, m_item->m_range.m_to);
-        nstring::instance_t* item = m_item->clone_slice();
-        return string_t(item, from, to, 8888);
+        const u32            from  = math::min(range_item()->m_range.m_from + _from, m_item->m_range.m_to);
+        const u32            to    = math::min(m_item->m_range.m_from + _to, m_item->m_range.m_to);
+        nstring::instance_t* slice = m_item->clone_slice();
+        return string_t(slice, from, to, 8888);
     }
 
     uchar32 string_t::operator[](s32 index) const
     {
         if (index >= size())
             return '\0';
-        ucs2::pcrune str = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        return str[index];
+        return nstring::s_data_rune(m_item->m_data, m_item->m_range.m_from + index);
+    }
+
+    string_t& string_t::assign_utf8(const char* utf8, s32 len)
+    {
+        release();
+        m_item = nstring::s_alloc_utf8(utf8, len);
+        return *this;
     }
 
     string_t& string_t::operator=(const char* other)
@@ -921,14 +4007,13 @@ namespace ncore
 
         if (strlen != 0)
         {
-            nstring::data_t*     data = nstring::s_alloc_data(strlen);
-            nstring::instance_t* item = nstring::s_alloc_instance({0, strlen}, data);
-            ucs2::prune          dst  = data->m_ptr;
+            nstring::instance_t* item = nstring::s_alloc_string(strlen);
+            ucs2::prune          dst  = item->m_data->m_ptr;
             ucs2::pcrune         end  = dst + strlen;
             while (dst < end)
             {
                 ucs2::rune r;
-                r      = *other;
+                r      = *other++;
                 *dst++ = r;
             }
             *dst                   = '\0';
@@ -946,20 +4031,46 @@ namespace ncore
 
     string_t& string_t::operator=(const string_t& other)
     {
-        if (this->m_item->m_data == other.m_item->m_data)
+        // A view of a clone views the runes of that clone
+        if (other.range_item()->m_slot == nstring::c_slot_clone)
+            nstring::s_make_writable(other.m_item);
+
+        if (this->item()->m_data == other.item()->m_data)
+        {
+            if (!nstring::s_is_default_instance(item()))
+            {
+                item()->m_slot         = -1;  // no longer a clone
+                item()->m_range.m_from = other.item()->m_range.m_from;
+                item()->m_range.m_to   = other.item()->m_range.m_to;
+            }
+        }
+        else if (nstring::s_is_default_instance(item()))
         {
-            m_item->m_range.m_from = other.m_item->m_range.m_from;
-            m_item->m_range.m_to   = other.m_item->m_range.m_to;
+            // The default instance is shared, so we need our own instance to become a view on 'other'
+            m_item = other.item()->clone_slice();
         }
         else
         {
-            m_item->m_data->remFromList(m_item);
-            m_item->m_data->detach();
+            // Not synced through item() while it is between two datas
+            nstring::instance_t* v = item();
+            v->invalidate();
+
+            v->m_data = other.item()->share()->attach();
+            if (!nstring::s_is_default_data(v->m_data))
+                nstring::s_track(v);
+            v->m_range.m_from = other.item()->m_range.m_from;
+            v->m_range.m_to   = other.item()->m_range.m_to;
+        }
+        return *this;
+    }
 
-            m_item->m_data = other.m_item->m_data->attach();
-            m_item->m_data->addToList(m_item);
-            m_item->m_range.m_from = other.m_item->m_range.m_from;
-            m_item->m_range.m_to   = other.m_item->m_range.m_to;
+    string_t& string_t::operator=(string_t&& other)
+    {
+        if (this != &other)
+        {
+            release();
+            m_item       = other.m_item;
+            other.m_item = nstring::s_get_default_instance();
         }
         return *this;
     }
@@ -970,8 +4081,17 @@ namespace ncore
         return *this;
     }
 
-    bool string_t::operator==(const string_t& other) const { return nstring::isEqual(m_item, m_item->m_range, other.m_item); }
-    bool string_t::operator!=(const string_t& other) const { return !nstring::isEqual(m_item, m_item->m_range, other.m_item); }
+    bool string_t::operator==(const string_t& other) const
+    {
+        if (nstring::s_is_interned(range_item()) && nstring::s_is_interned(other.range_item()))
+            return range_item()->m_data == other.range_item()->m_data;
+        return nstring::isEqual(range_item(), m_item->m_range.local(), other.range_item());
+    }
+    bool string_t::operator!=(const string_t& other) const { return !(*this == other); }
+    bool string_t::operator<(const string_t& other) const { return compare(other) < 0; }
+    bool string_t::operator<=(const string_t& other) const { return compare(other) <= 0; }
+    bool string_t::operator>(const string_t& other) const { return compare(other) > 0; }
+    bool string_t::operator>=(const string_t& other) const { return compare(other) >= 0; }
 
     void string_t::release() { m_item = m_item->release(); }
 
@@ -984,18 +4104,15 @@ namespace ncore
         from = math::min(from, (u32)size());
         to   = math::min(to, (u32)size());
 
-        nstring::instance_t* item = m_item->clone_slice();
-        item->m_range.m_from      = m_item->m_range.m_from + from;
-        item->m_range.m_to        = m_item->m_range.m_from + to;
-
-        string_t str;
-        str.m_item = item;
-        return str;
+        nstring::instance_t* slice = range_item()->clone_slice();
+        slice->m_range.m_from      = m_item->m_range.m_from + from;
+        slice->m_range.m_to        = m_item->m_range.m_from + to;
+        return string_t(slice, 8888);
     }
 
     string_t string_t::selectUntil(uchar32 find) const
     {
-        nstring::range_t view = nstring::findCharUntil(m_item, find);
+        nstring::range_t view = nstring::findCharUntil(range_item(), find);
         if (view.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
         return select(view.m_from, view.m_to);
@@ -1003,7 +4120,7 @@ namespace ncore
 
     string_t string_t::selectUntil(const string_t& selection) const
     {
-        nstring::range_t view = nstring::selectBeforeLocal(m_item, selection.m_item);
+        nstring::range_t view = nstring::selectBeforeLocal(range_item(), selection.range_item());
         if (view.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
         return select(view.m_from, view.m_to);
@@ -1011,7 +4128,7 @@ namespace ncore
 
     string_t string_t::selectUntilLast(uchar32 find) const
     {
-        nstring::range_t view = nstring::findCharUntilLast(m_item, find);
+        nstring::range_t view = nstring::findCharUntilLast(range_item(), find);
         if (view.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
         return select(view.m_from, view.m_to);
@@ -1020,7 +4137,7 @@ namespace ncore
     string_t string_t::selectUntilLast(const string_t& selection) const
     {
         // TODO What if 'selection' is not part of this string ?
-        nstring::range_t view = nstring::selectBeforeLocal(m_item, selection.m_item);
+        nstring::range_t view = nstring::selectBeforeLocal(range_item(), selection.range_item());
         if (view.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
         return select(view.m_from, view.m_to);
@@ -1028,7 +4145,7 @@ namespace ncore
 
     string_t string_t::selectUntilIncluded(uchar32 find) const
     {
-        nstring::range_t view = nstring::findCharUntil(m_item, find);
+        nstring::range_t view = nstring::findCharUntil(range_item(), find);
         if (view.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
         return select(view.m_from, view.m_to + 1);
@@ -1036,7 +4153,7 @@ namespace ncore
 
     string_t string_t::selectUntilIncluded(const string_t& selection) const
     {
-        nstring::range_t view = nstring::selectBeforeIncludedLocal(m_item, selection.m_item);
+        nstring::range_t view = nstring::selectBeforeIncludedLocal(range_item(), selection.range_item());
         if (view.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
         return select(view.m_from, view.m_to);
@@ -1044,69 +4161,55 @@ namespace ncore
 
     string_t string_t::selectUntilEndExcludeSelection(const string_t& selection) const
     {
-        nstring::range_t     range = nstring::selectAfterLocal(m_item, selection.m_item);
-        nstring::instance_t* item  = m_item->clone_slice();
-        return string_t(item, range.m_from, range.m_to, 8888);
+        nstring::range_t     range = nstring::selectAfterLocal(range_item(), selection.range_item());
+        nstring::instance_t* slice = m_item->clone_slice();
+        return string_t(slice, range.m_from, range.m_to, 8888);
     }
     string_t string_t::selectUntilEndIncludeSelection(const string_t& selection) const
     {
-        nstring::range_t     range = nstring::selectAfterIncludedLocal(m_item, selection.m_item);
-        nstring::instance_t* item  = m_item->clone_slice();
-        return string_t(item, range.m_from, range.m_to, 8888);
+        nstring::range_t     range = nstring::selectAfterIncludedLocal(range_item(), selection.range_item());
+        nstring::instance_t* slice = m_item->clone_slice();
+        return string_t(slice, range.m_from, range.m_to, 8888);
     }
 
     bool string_t::isUpper() const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        ucs2::pcrune strend  = m_item->m_data->m_ptr + m_item->m_range.m_to;
-        while (strdata < strend)
-        {
-            ucs2::rune r = *strdata++;
-            if (nrunes::is_lower(r))
-                return false;
-        }
-        return true;
+        nstring::instance_t const* v = range_item();
+        return nstring::s_span_class_in_view(v, nstring::c_class_lower, false) == v->size();
     }
 
     bool string_t::isLower() const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        ucs2::pcrune strend  = m_item->m_data->m_ptr + m_item->m_range.m_to;
-        while (strdata < strend)
-        {
-            ucs2::rune r = *strdata++;
-            if (nrunes::is_upper(r))
-                return false;
-        }
-        return true;
+        nstring::instance_t const* v = range_item();
+        return nstring::s_span_class_in_view(v, nstring::c_class_upper, false) == v->size();
     }
 
     bool string_t::isCapitalized() const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        ucs2::pcrune strend  = m_item->m_data->m_ptr + m_item->m_range.m_to;
+        ucs2::pcrune strdata = item()->m_data->m_ptr + item()->m_range.m_from;
+        ucs2::pcrune strend  = item()->m_data->m_ptr + item()->m_range.m_to;
         while (strdata < strend)
         {
             ucs2::rune c = *strdata++;
             while (strdata < strend)
             {
-                if (!nrunes::is_space(c))
+                if (!nbmp::is_space(c))
                     break;
                 c = *strdata++;
             }
-            if (nrunes::is_upper(c))
+            if (nbmp::is_upper(c))
             {
                 while (strdata < strend)
                 {
                     c = *strdata;
-                    if (nrunes::is_space(c))
+                    if (nbmp::is_space(c))
                         break;
-                    if (nrunes::is_upper(c))
+                    if (nbmp::is_upper(c))
                         return false;
                     strdata++;
                 }
             }
-            else if (nrunes::is_alpha(c))
+            else if (nbmp::is_alpha(c))
             {
                 return false;
             }
@@ -1119,28 +4222,37 @@ namespace ncore
 
     bool string_t::isDelimited(uchar32 inLeft, uchar32 inRight) const
     {
-        if (m_item->m_range.is_empty())
+        nstring::instance_t const* v = range_item();
+        if (v->m_range.is_empty())
             return false;
-        ucs2::rune const l = m_item->m_data->m_ptr[m_item->m_range.m_from];
-        ucs2::rune const r = m_item->m_data->m_ptr[m_item->m_range.m_to - 1];
+        ucs2::rune const l = nstring::s_data_rune(v->m_data, v->m_range.m_from);
+        ucs2::rune const r = nstring::s_data_rune(v->m_data, v->m_range.m_to - 1);
         return (l == inLeft && r == inRight);
     }
 
-    uchar32 string_t::firstChar() const { return m_item->m_data->m_ptr[m_item->m_range.m_from]; }
+    uchar32 string_t::firstChar() const
+    {
+        nstring::instance_t const* v = range_item();
+        if (v->m_range.is_empty())
+            return '\0';
+        return nstring::s_data_rune(v->m_data, v->m_range.m_from);
+    }
+
     uchar32 string_t::lastChar() const
     {
-        if (m_item->m_range.is_empty())
+        nstring::instance_t const* v = range_item();
+        if (v->m_range.is_empty())
             return '\0';
-        return m_item->m_data->m_ptr[m_item->m_range.m_to - 1];
+        return nstring::s_data_rune(v->m_data, v->m_range.m_to - 1);
     }
 
     bool string_t::startsWith(const string_t& start) const
     {
         if (start.size() > 0)
         {
-            nstring::range_t v = start.m_item->m_range.local();
-            if (v.is_inside(m_item->m_range))
-                return nstring::isEqual(m_item, v, start.m_item);
+            nstring::range_t v = start.item()->m_range.local();
+            if (v.m_to <= size())
+                return nstring::isEqual(range_item(), v, start.range_item());
         }
         return false;
     }
@@ -1153,69 +4265,50 @@ namespace ncore
         v.m_from           = size() - end.size();
         v.m_to             = size();
         if (!v.is_empty())
-            return nstring::isEqual(m_item, v, end.m_item);
+            return nstring::isEqual(range_item(), v, end.range_item());
         return false;
     }
 
     string_t string_t::find(uchar32 find) const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        for (s32 i = 0; i < size(); i++)
-        {
-            uchar32 const c = strdata[i];
-            if (c == find)
-                return select(i, i + 1);
-        }
-        return string_t(nstring::s_get_default_instance(), 8888);
+        nstring::match_rune_t const match = {find};
+        s32 const                   i     = nstring::s_find_rune(range_item(), match);
+        if (i < 0)
+            return string_t(nstring::s_get_default_instance(), 8888);
+        return select(i, i + 1);
     }
 
     string_t string_t::findLast(uchar32 find) const
     {
-        if (size() == 0)
+        nstring::match_rune_t const match = {find};
+        s32 const                   i     = nstring::s_find_last_rune(range_item(), match);
+        if (i < 0)
             return string_t(nstring::s_get_default_instance(), 8888);
-
-        ucs2::pcrune strbegin = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        ucs2::pcrune strdata  = m_item->m_data->m_ptr + m_item->m_range.m_to - 1;
-        while (strdata >= strbegin)
-        {
-            uchar32 const c = *strdata;
-            if (c == find)
-                return select((s32)(strdata - strbegin), (s32)((strdata + 1) - strbegin));
-            strdata++;
-        }
-        return string_t(nstring::s_get_default_instance(), 8888);
+        return select(i, i + 1);
     }
 
     string_t string_t::find(const char* inFind) const
     {
-        ucs2::pcrune str = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        s32 const    len = size();
-        for (s32 i = 0; i < len; i++)
+        // Widen short ASCII strings on the stack so that they can use the same search
+        ucs2::rune runes[64];
+        s32        findlen = 0;
+        while (inFind[findlen] != '\0')
         {
-            uchar32 const c = str[i];
-            if (c == (uchar32)*inFind)
-            {
-                s32 s = 1;
-                for (s32 j = i + 1; j < len; j++, ++s)
-                {
-                    if (inFind[s] == '\0')
-                        return select(m_item->m_range.m_from + i, m_item->m_range.m_from + j);
-                    if (str[j] != inFind[s])
-                        break;
-                }
-                if (inFind[s] == '\0')
-                    return select(m_item->m_range.m_from + i, m_item->m_range.m_from + len);
-            }
+            if (findlen == 64)
+                return find(string_t(inFind));
+            runes[findlen] = (ucs2::rune)(uchar8)inFind[findlen];
+            ++findlen;
         }
-        return string_t(nstring::s_get_default_instance(), 8888);
+
+        s32 const i = nstring::s_find_in_view(range_item(), runes, findlen);
+        if (i < 0)
+            return string_t(nstring::s_get_default_instance(), 8888);
+        return select(i, i + findlen);
     }
 
     string_t string_t::find(const string_t& find) const
     {
-        if (find.size() > size())
-            return string_t(nstring::s_get_default_instance(), 8888);
-
-        nstring::range_t v = nstring::s_find(m_item, find.m_item);
+        nstring::range_t v = nstring::s_find(range_item(), find.item());
         if (v.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
 
@@ -1224,155 +4317,112 @@ namespace ncore
 
     string_t string_t::findLast(const string_t& find) const
     {
-        if (find.size() > size())
+        nstring::range_t v = nstring::s_find_last(range_item(), find.item());
+        if (v.is_empty())
             return string_t(nstring::s_get_default_instance(), 8888);
 
-        nstring::range_t v = {0, 0};
-        v.m_from           = size() - find.size();
-        v.m_to             = size();
-
-        while (!v.is_empty())
-        {
-            if (nstring::isEqual(m_item, v, find.m_item))
-            {
-                // So here we have a view with the size of the @find string on
-                // string @str that matches the string @find.
-                return select(v.m_from, v.m_to);
-            }
-            if (!s_move_view(m_item, v, -1))
-                break;
-        }
-        return string_t(nstring::s_get_default_instance(), 8888);
+        return select(v.m_from, v.m_to);
     }
 
     string_t string_t::findOneOf(const string_t& charset) const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        for (s32 i = 0; i < size(); i++)
-        {
-            uchar32 const sc = strdata[i];
-            if (charset.contains(sc))
-            {
-                return select(i, i + 1);
-            }
-        }
-        return string_t(nstring::s_get_default_instance(), 8888);
+        charset_t const set(charset);
+        return findOneOf(set);
     }
 
-    string_t string_t::findOneOfLast(const string_t& charset) const
+    string_t string_t::findOneOf(const charset_t& charset) const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        for (s32 i = size() - 1; i >= 0; --i)
-        {
-            uchar32 const sc = strdata[i];
-            if (charset.contains(sc))
-            {
-                return select(i, i + 1);
-            }
-        }
-        return string_t(nstring::s_get_default_instance(), 8888);
+        nstring::match_set_t const match = {charset};
+        s32 const                  i     = nstring::s_find_rune(range_item(), match);
+        if (i < 0)
+            return string_t(nstring::s_get_default_instance(), 8888);
+        return select(i, i + 1);
     }
 
-    s32  string_t::compare(const string_t& rhs) const { return nstring::compare(m_item, m_item->m_range, rhs.m_item); }
-    bool string_t::isEqual(const string_t& rhs) const { return nstring::compare(m_item, m_item->m_range, rhs.m_item) == 0; }
+    string_t string_t::findOneOfLast(const string_t& charset) const
+    {
+        charset_t const set(charset);
+        return findOneOfLast(set);
+    }
 
-    bool string_t::contains(const string_t& contains) const
+    string_t string_t::findOneOfLast(const charset_t& charset) const
     {
-        if (contains.size() > size())
-            return false;
+        nstring::match_set_t const match = {charset};
+        s32 const                  i     = nstring::s_find_last_rune(range_item(), match);
+        if (i < 0)
+            return string_t(nstring::s_get_default_instance(), 8888);
+        return select(i, i + 1);
+    }
 
-        nstring::range_t v = {0, 0};
-        v.m_to             = contains.size();
+    s32  string_t::compare(const string_t& rhs) const { return nstring::compare(range_item(), m_item->m_range.local(), rhs.range_item()); }
+    bool string_t::isEqual(const string_t& rhs) const { return *this == rhs; }
 
-        while (!v.is_empty())
-        {
-            if (nstring::isEqual(m_item, v, contains.m_item))
-            {
-                return true;
-            }
-            if (!s_move_view(m_item, v, 1))
-                break;
-        }
-        return false;
-    }
+    bool string_t::contains(const string_t& contains) const { return !nstring::s_find(range_item(), contains.item()).is_empty(); }
 
     bool string_t::contains(uchar32 contains) const
     {
-        ucs2::pcrune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        for (s32 i = 0; i < size(); i++)
-        {
-            uchar32 const sc = strdata[i];
-            if (sc == contains)
-            {
-                return true;
-            }
-        }
-        return false;
+        nstring::match_rune_t const match = {contains};
+        return nstring::s_find_rune(range_item(), match) >= 0;
     }
 
     void string_t::concatenate(const string_t& con)
     {
-        s32 const len = size() + con.size();
-        s_resize_data(m_item->m_data, len);
-
-        // manually append the incoming string to the end of the current string
-        ucs2::pcrune src = con.m_item->m_data->m_ptr + con.m_item->m_range.m_from;
-        ucs2::prune  dst = m_item->m_data->m_ptr + m_item->m_range.m_to;
-        for (s32 i = 0; i < con.size(); i++)
-            *dst++ = *src++;
-        *dst = '\0';
-
-        m_item->m_range.m_to = len;
+        make_writable();
+        if (nstring::s_is_default_instance(item()))
+            m_item = nstring::s_alloc_string(0);
+
+        // append space to the end of the current string and copy the incoming string into it, the
+        // size and location of @con are read after appending since it may be a view on our data
+        s32 const    len = con.size();
+        ucs2::prune  dst = nstring::s_append_space(item(), len);
+        ucs2::pcrune src = con.item()->m_data->m_ptr + con.item()->m_range.m_from;
+        nmem::memmove(dst, src, len * sizeof(ucs2::rune));
     }
 
     void string_t::concatenate(const string_t& strA, const string_t& strB)
     {
-        s32 const len = size() + strA.size() + strB.size();
-        s_resize_data(m_item->m_data, len);
-
-        // manually append the incoming strings to the end of the current string
-        ucs2::prune dst = m_item->m_data->m_ptr + m_item->m_range.m_to;
-
-        ucs2::pcrune srcA = strA.m_item->m_data->m_ptr + strA.m_item->m_range.m_from;
-        for (s32 i = 0; i < strA.size(); i++)
-            *dst++ = *srcA++;
-
-        ucs2::pcrune srcB = strB.m_item->m_data->m_ptr + strB.m_item->m_range.m_from;
-        for (s32 i = 0; i < strB.size(); i++)
-            *dst++ = *srcB++;
-
-        *dst = '\0';
-
-        m_item->m_range.m_to = len;
+        make_writable();
+        if (nstring::s_is_default_instance(item()))
+            m_item = nstring::s_alloc_string(0);
+
+        s32 const   lenA = strA.size();
+        s32 const   lenB = strB.size();
+        ucs2::prune dst  = nstring::s_append_space(item(), lenA + lenB);
+
+        ucs2::pcrune srcA = strA.item()->m_data->m_ptr + strA.item()->m_range.m_from;
+        nmem::memmove(dst, srcA, lenA * sizeof(ucs2::rune));
+        ucs2::pcrune srcB = strB.item()->m_data->m_ptr + strB.item()->m_range.m_from;
+        nmem::memmove(dst + lenA, srcB, lenB * sizeof(ucs2::rune));
     }
 
     void string_t::concatenate_repeat(const string_t& con, s32 ntimes)
     {
-        s32 const len = size() + (con.size() * ntimes);
-        s_resize_data(m_item->m_data, len);
-
-        ucs2::prune dst = m_item->m_data->m_ptr + m_item->m_range.m_to;
+        if (ntimes <= 0)
+            return;
+        make_writable();
+        if (nstring::s_is_default_instance(item()))
+            m_item = nstring::s_alloc_string(0);
+
+        s32 const   len = con.size();
+        ucs2::prune dst = nstring::s_append_space(item(), len * ntimes);
         for (s32 i = 0; i < ntimes; ++i)
         {
-            ucs2::pcrune src = con.m_item->m_data->m_ptr + con.m_item->m_range.m_from;
-            for (s32 i = 0; i < con.size(); i++)
-                *dst++ = *src++;
+            ucs2::pcrune src = con.item()->m_data->m_ptr + con.item()->m_range.m_from;
+            nmem::memmove(dst, src, len * sizeof(ucs2::rune));
+            dst += len;
         }
-        *dst                 = '\0';
-        m_item->m_range.m_to = len;
     }
 
     s32 string_t::format(const string_t& format, const va_t* argv, s32 argc)
     {
         release();
 
-        crunes_t  fmt = ucs2::make_crunes(format.m_item->m_data->m_ptr, format.m_item->m_range.m_from, format.m_item->m_range.m_to, format.m_item->m_data->m_len);
+        crunes_t  fmt = ucs2::make_crunes(format.item()->m_data->m_ptr, format.item()->m_range.m_from, format.item()->m_range.m_to, format.item()->m_data->m_len);
         const s32 len = cprintf_(fmt, argv, argc);
 
-        nstring::data_t*     data = nstring::s_alloc_data(len);
-        nstring::instance_t* item = nstring::s_alloc_instance({0, len}, data);
+        nstring::instance_t* item = nstring::s_alloc_string(len);
 
-        runes_t str = ucs2::make_runes(item->m_data->m_ptr, item->m_range.m_from, item->m_range.m_to, item->m_data->m_len);
+        runes_t str = ucs2::make_runes(item->m_data->m_ptr, 0, 0, len);
         sprintf_(str, fmt, argv, argc);
         item->m_range.m_to = str.m_end;
 
@@ -1382,337 +4432,242 @@ namespace ncore
 
     s32 string_t::formatAdd(const string_t& format, const va_t* argv, s32 argc)
     {
-        crunes_t  fmt = ucs2::make_crunes(format.m_item->m_data->m_ptr, format.m_item->m_range.m_from, format.m_item->m_range.m_to, format.m_item->m_data->m_len);
+        crunes_t  fmt = ucs2::make_crunes(format.item()->m_data->m_ptr, format.item()->m_range.m_from, format.item()->m_range.m_to, format.item()->m_data->m_len);
         const s32 len = cprintf_(fmt, argv, argc);
-        s_resize_data(m_item->m_data, len);
-        runes_t str = ucs2::make_runes(m_item->m_data->m_ptr, m_item->m_range.m_from, m_item->m_range.m_to, m_item->m_data->m_len);
-        str.m_str   = str.m_end;
+        make_writable();
+        if (nstring::s_is_default_instance(item()))
+            m_item = nstring::s_alloc_string(0);
+
+        // reserve the space at the end of the string and format into it
+        s32 const pos = item()->m_range.m_to;
+        nstring::s_append_space(item(), len);
+        runes_t str = ucs2::make_runes(item()->m_data->m_ptr, pos, pos, pos + len);
         sprintf_(str, fmt, argv, argc);
-        m_item->m_range.m_to = str.m_end;
         return len;
     }
 
     void string_t::insertReplaceSelection(const string_t& selection, const string_t& insert)
     {
-        nstring::range_t range = selection.m_item->m_range;
-        s_string_insert(m_item, range, insert.m_item);
+        nstring::range_t range = selection.range_item()->m_range;
+        range.move(make_writable());
+        s_string_insert(range_item(), range, insert.item());
     }
 
     void string_t::insertBeforeSelection(const string_t& selection, const string_t& insert)
     {
-        nstring::range_t range(selection.m_item->m_range);
+        nstring::range_t range(selection.range_item()->m_range);
         range.m_to = range.m_from;
-        s_string_insert(m_item, range, insert.m_item);
+        range.move(make_writable());
+        s_string_insert(range_item(), range, insert.item());
     }
 
     void string_t::insertAfterSelection(const string_t& selection, const string_t& insert)
     {
-        nstring::range_t range = nstring::selectAfterLocal(m_item, selection.m_item);
-        range.m_from           = range.m_to;
-        s_string_insert(m_item, range, insert.m_item);
+        nstring::range_t range(selection.range_item()->m_range);
+        range.m_from = range.m_to;
+        range.move(make_writable());
+        s_string_insert(range_item(), range, insert.item());
     }
 
-    void string_t::removeSelection(const string_t& selection) { string_remove(m_item, selection.m_item->m_range); }
+    void string_t::removeSelection(const string_t& selection)
+    {
+        nstring::range_t range = selection.range_item()->m_range;
+        range.move(make_writable());
+        string_remove(range_item(), range);
+    }
 
-    s32 string_t::findRemove(const string_t& find, s32 ntimes)
+    void string_t::flatten()
     {
-        nstring::range_t v = {0, 0};
-        v.m_to             = find.size();
+        nstring::data_t* data = range_item()->m_data;
+        if ((natomic::load(&data->m_flags) & nstring::c_data_flatten) != 0)
+            nstring::s_flatten(data);
+    }
 
-        for (s32 i = 0; i < ntimes; i++)
-        {
-            while (!v.is_empty())
-            {
-                if (nstring::isEqual(m_item, v, find.m_item))
-                {
-                    // So here we have a view with the size of the @find string on
-                    // string @str that matches the string @find.
-                    // We need to remove this part from the string.
-                    string_remove(m_item, v);
-                    break;
-                }
-                else
-                {
-                    if (!s_move_view(m_item, v, 1))
-                    {
-                        return i + 1;  // did not find the string, so we are done
-                    }
-                }
-            }
-        }
-        return ntimes;
+    s32 string_t::findRemove(const string_t& find, s32 ntimes)
+    {
+        make_writable();
+        return nstring::s_find_replace(item(), find.item(), nstring::s_get_default_instance(), ntimes);
     }
 
     s32 string_t::findReplace(const string_t& find, const string_t& replace, s32 ntimes)
     {
-        for (s32 i = 0; i < ntimes; i++)
-        {
-            if (s_find_replace(m_item, find.m_item, replace.m_item) == 0)
-                return i + 1;
-        }
-        return ntimes;
+        make_writable();
+        // The runes of @replace are read while this string is being rewritten, so they cannot be part of it
+        if (!replace.is_empty() && replace.item()->m_data == item()->m_data)
+            return nstring::s_find_replace(item(), find.item(), string_t(replace.item()->clone_full(), 8888).m_item, ntimes);
+        return nstring::s_find_replace(item(), find.item(), replace.item(), ntimes);
     }
 
+    s32 string_t::findReplaceAll(const string_t& find, const string_t& replace) { return findReplace(find, replace, 0x7fffffff); }
+
     s32 string_t::removeChar(uchar32 c, s32 ntimes)
     {
-        s32 n = ntimes;
-        if (n == 0)
-            n = size();
-
-        ucs2::prune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-
-        s32 i = 0;
-        s32 p = 0;
-        while (i < size())
-        {
-            if (n > 0 && strdata[i] == c)
-            {
-                --n;
-                ++i;
-                continue;
-            }
-            if (p < i)
-            {
-                strdata[p] = strdata[i];
-            }
-            ++p;
-            ++i;
-        }
-        if (p < i)
-            strdata[p] = '\0';
-
-        // adjust the 'to' of the string
-        m_item->m_range.m_to -= ntimes - n;
-
-        return ntimes - n;
+        nstring::match_rune_t const match = {c};
+        make_writable();
+        return nstring::s_remove_if(item(), match, ntimes == 0 ? size() : ntimes);
     }
 
     s32 string_t::removeAnyChar(const string_t& any, s32 ntimes)
     {
-        ucs2::prune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        s32         len     = size();
-
-        if (ntimes == 0)
-            ntimes = len;
+        charset_t const set(any);
+        return removeAnyChar(set, ntimes);
+    }
 
-        s32 i = 0;
-        s32 n = 0;
-        while (i < len)
-        {
-            if (n < ntimes && any.contains(strdata[i]))
-            {
-                string_remove(m_item, {i, i + 1});
-                --len;
-                ++n;
-                continue;
-            }
-            ++i;
-        }
-        return n;
+    s32 string_t::removeAnyChar(const charset_t& any, s32 ntimes)
+    {
+        nstring::match_set_t const match = {any};
+        make_writable();
+        return nstring::s_remove_if(item(), match, ntimes == 0 ? size() : ntimes);
     }
 
     s32 string_t::replaceAnyChar(const string_t& any, uchar32 with, s32 ntimes)
     {
-        // Replace any of the characters in @charset from @str with character @with
-        ucs2::prune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        s32         n       = ntimes == 0 ? size() : ntimes;
-        for (s32 i = 0; i < size(); ++i)
+        charset_t const set(any);
+        return replaceAnyChar(set, with, ntimes);
+    }
+
+    s32 string_t::replaceAnyChar(const charset_t& any, uchar32 with, s32 ntimes)
+    {
+        // Replace any of the characters in @any with character @with, returns the number of replacements
+        make_writable();
+        ucs2::prune strdata = item()->m_data->m_ptr + item()->m_range.m_from;
+        s32 const   len     = size();
+        s32 const   n       = ntimes == 0 ? len : ntimes;
+        s32         r       = 0;
+        for (s32 i = 0; i < len && r < n; ++i)
         {
-            uchar32 const c = strdata[i];
-            if (any.contains(c))
+            if (any.contains(strdata[i]))
             {
-                if (--n == 0)
-                    break;
-                strdata[i] = with;
+                strdata[i] = (ucs2::rune)with;
+                ++r;
             }
         }
-        return n;
+        return r;
     }
 
     void string_t::toUpper()
     {
-        ucs2::prune  strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        ucs2::pcrune strend  = m_item->m_data->m_ptr + m_item->m_range.m_to;
-        while (strdata < strend)
-        {
-            *strdata = nrunes::to_upper(*strdata);
-            ++strdata;
-        }
+        make_writable();
+        nstring::instance_t const* v = range_item();
+        nstring::s_map_case_in_data(v->m_data, v->m_range.m_from, v->m_range.m_to, nstring::c_case_upper);
     }
 
     void string_t::toLower()
     {
-        ucs2::prune  strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        ucs2::pcrune strend  = m_item->m_data->m_ptr + m_item->m_range.m_to;
-        while (strdata < strend)
-        {
-            *strdata = nrunes::to_lower(*strdata);
-            ++strdata;
-        }
+        make_writable();
+        nstring::instance_t const* v = range_item();
+        nstring::s_map_case_in_data(v->m_data, v->m_range.m_from, v->m_range.m_to, nstring::c_case_lower);
     }
 
     void string_t::capitalize()
     {
         // Standard separator is ' '
-        bool        prev_is_space = true;
-        s32         i             = 0;
-        ucs2::prune strdata       = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        while (i < size())
-        {
-            uchar32 c = strdata[i];
-            uchar32 d = c;
-            if (nrunes::is_alpha(c))
-            {
-                if (prev_is_space)
-                {
-                    c = nrunes::to_upper(c);
-                }
-                else
-                {
-                    c = nrunes::to_lower(c);
-                }
-            }
-            else
-            {
-                prev_is_space = nrunes::is_space(c);
-            }
-
-            if (c != d)
-            {
-                strdata[i] = c;
-            }
-            i++;
-        }
+        make_writable();
+        nstring::instance_t const* v = item();
+        nstring::s_capitalize(v->m_data->m_ptr + v->m_range.m_from, v->size(), true, nstring::match_space_t());
     }
 
     void string_t::capitalize(const string_t& separators)
     {
-        bool        prev_is_space = false;
-        s32         i             = 0;
-        ucs2::prune strdata       = m_item->m_data->m_ptr + m_item->m_range.m_from;
-        while (i < size())
-        {
-            uchar32 c = strdata[i];
-            uchar32 d = c;
-            if (nrunes::is_alpha(c))
-            {
-                if (prev_is_space)
-                {
-                    c = nrunes::to_upper(c);
-                }
-                else
-                {
-                    c = nrunes::to_lower(c);
-                }
-            }
-            else
-            {
-                prev_is_space = false;
-                for (s32 j = 0; j < separators.size(); j++)
-                {
-                    if (separators[j] == c)
-                    {
-                        prev_is_space = true;
-                        break;
-                    }
-                }
-            }
-            if (c != d)
-            {
-                strdata[i] = c;
-            }
-            i++;
-        }
+        charset_t const set(separators);
+        capitalize(set);
     }
 
-    static void sTrimLeft(nstring::instance_t* item, ucs2::pcrune any, s32 num)
+    void string_t::capitalize(const charset_t& separators)
+    {
+        make_writable();
+        nstring::instance_t const*  v     = item();
+        nstring::match_set_t const match = {separators};
+        nstring::s_capitalize(v->m_data->m_ptr + v->m_range.m_from, v->size(), false, match);
+    }
+
+    template <typename M> static void sTrimLeft(nstring::instance_t* item, M const& match)
     {
         ucs2::pcrune end   = item->m_data->m_ptr + item->m_range.m_to;
         ucs2::pcrune begin = item->m_data->m_ptr + item->m_range.m_from;
-    trim_continue:
-        while (begin < end)
-        {
-            uchar16 const c = *begin;
-            for (s32 j = 0; j < num; ++j)
-            {
-                if (c == any[j])
-                {
-                    ++begin;
-                    goto trim_continue;
-                }
-            }
-            break;
-        }
+        while (begin < end && match(*begin))
+            ++begin;
         item->m_range.m_from = (u32)(begin - item->m_data->m_ptr);
     }
 
-    static void sTrimRight(nstring::instance_t* item, ucs2::pcrune any, s32 num)
+    template <typename M> static void sTrimRight(nstring::instance_t* item, M const& match)
     {
         ucs2::pcrune end   = item->m_data->m_ptr + item->m_range.m_to;
         ucs2::pcrune begin = item->m_data->m_ptr + item->m_range.m_from;
-    trim_continue:
-        while (end > begin)
-        {
-            uchar16 const c = end[-1];
-            for (s32 j = 0; j < num; ++j)
-            {
-                if (c == any[j])
-                {
-                    --end;
-                    goto trim_continue;
-                }
-            }
-            break;
-        }
+        while (end > begin && match(end[-1]))
+            --end;
         item->m_range.m_to = (u32)(end - item->m_data->m_ptr);
     }
 
-    static const ucs2::rune sTrimWhiteSpace[] = {' ', '\t', '\r', '\n'};
+    // White space as defined by Unicode (White_Space property)
+    static const nstring::match_space_t sTrimWhiteSpaceMatch = {};
 
     // Trim does nothing more than narrowing the <from, to>, nothing is actually removed
     // from the actual underlying string string_data.
     void string_t::trim()
     {
-        sTrimLeft(m_item, sTrimWhiteSpace, sizeof(sTrimWhiteSpace) / sizeof(sTrimWhiteSpace[0]));
-        sTrimRight(m_item, sTrimWhiteSpace, sizeof(sTrimWhiteSpace) / sizeof(sTrimWhiteSpace[0]));
+        sTrimLeft(item(), sTrimWhiteSpaceMatch);
+        sTrimRight(item(), sTrimWhiteSpaceMatch);
     }
 
-    void string_t::trimLeft() { sTrimLeft(m_item, sTrimWhiteSpace, sizeof(sTrimWhiteSpace) / sizeof(sTrimWhiteSpace[0])); }
-    void string_t::trimRight() { sTrimRight(m_item, sTrimWhiteSpace, sizeof(sTrimWhiteSpace) / sizeof(sTrimWhiteSpace[0])); }
+    void string_t::trimLeft() { sTrimLeft(item(), sTrimWhiteSpaceMatch); }
+    void string_t::trimRight() { sTrimRight(item(), sTrimWhiteSpaceMatch); }
 
     void string_t::trim(uchar32 c)
     {
-        ucs2::rune any[2];
-        any[0] = c;
-        any[1] = '\0';
-        sTrimLeft(m_item, any, 1);
-        sTrimRight(m_item, any, 1);
+        nstring::match_rune_t const match = {c};
+        sTrimLeft(item(), match);
+        sTrimRight(item(), match);
     }
 
     void string_t::trimLeft(uchar32 c)
     {
-        ucs2::rune any[2];
-        any[0] = c;
-        any[1] = '\0';
-        sTrimLeft(m_item, any, 1);
+        nstring::match_rune_t const match = {c};
+        sTrimLeft(item(), match);
     }
 
     void string_t::trimRight(uchar32 c)
     {
-        ucs2::rune any[2];
-        any[0] = c;
-        any[1] = '\0';
-        sTrimRight(m_item, any, 1);
+        nstring::match_rune_t const match = {c};
+        sTrimRight(item(), match);
     }
 
     void string_t::trim(const string_t& set)
     {
-        sTrimLeft(m_item, set.m_item->m_data->m_ptr, set.size());
-        sTrimRight(m_item, set.m_item->m_data->m_ptr, set.size());
+        charset_t const charset(set);
+        trim(charset);
+    }
+
+    void string_t::trimLeft(const string_t& set)
+    {
+        charset_t const charset(set);
+        trimLeft(charset);
+    }
+
+    void string_t::trimRight(const string_t& set)
+    {
+        charset_t const charset(set);
+        trimRight(charset);
+    }
+
+    void string_t::trim(const charset_t& set)
+    {
+        nstring::match_set_t const match = {set};
+        sTrimLeft(item(), match);
+        sTrimRight(item(), match);
+    }
+
+    void string_t::trimLeft(const charset_t& set)
+    {
+        nstring::match_set_t const match = {set};
+        sTrimLeft(item(), match);
     }
 
-    void string_t::trimLeft(const string_t& set) { sTrimLeft(m_item, set.m_item->m_data->m_ptr, set.size()); }
-    void string_t::trimRight(const string_t& set) { sTrimRight(m_item, set.m_item->m_data->m_ptr, set.size()); }
+    void string_t::trimRight(const charset_t& set)
+    {
+        nstring::match_set_t const match = {set};
+        sTrimRight(item(), match);
+    }
 
     void string_t::trimQuotes()
     {
@@ -1733,8 +4688,9 @@ namespace ncore
 
     void string_t::reverse()
     {
+        make_writable();
         s32 const   last    = size() - 1;
-        ucs2::prune strdata = m_item->m_data->m_ptr + m_item->m_range.m_from;
+        ucs2::prune strdata = item()->m_data->m_ptr + item()->m_range.m_from;
         for (s32 i = 0; i < (last - i); ++i)
         {
             uchar32 l         = strdata[i];
@@ -1746,7 +4702,7 @@ namespace ncore
 
     bool string_t::selectBeforeAndAfter(const string_t& selection, string_t& outLeft, string_t& outRight) const
     {
-        nstring::range_t range = nstring::selectBeforeLocal(m_item, selection.m_item);
+        nstring::range_t range = nstring::selectBeforeLocal(range_item(), selection.range_item());
         if (range.is_empty())
             return false;
         outLeft  = select(range.m_from, range.m_to);
@@ -1756,7 +4712,7 @@ namespace ncore
 
     bool string_t::findCharSelectBeforeAndAfter(uchar32 find, string_t& outLeft, string_t& outRight) const
     {
-        nstring::range_t range = nstring::findCharUntil(m_item, find);
+        nstring::range_t range = nstring::findCharUntil(range_item(), find);
         if (range.is_empty())
             return false;
         outLeft  = select(range.m_from, range.m_to);
@@ -1766,7 +4722,7 @@ namespace ncore
 
     bool string_t::findCharLastSelectBeforeAndAfter(uchar32 find, string_t& outLeft, string_t& outRight) const
     {
-        nstring::range_t range = nstring::findCharUntilLast(m_item, find);
+        nstring::range_t range = nstring::findCharUntilLast(range_item(), find);
         if (range.is_empty())
             return false;
         outLeft  = select(range.m_from, range.m_to);
@@ -1776,7 +4732,7 @@ namespace ncore
 
     bool string_t::findStrSelectBeforeAndAfter(const string_t& find, string_t& outLeft, string_t& outRight) const
     {
-        nstring::range_t range = nstring::findStrUntil(m_item, find.m_item);
+        nstring::range_t range = nstring::findStrUntil(range_item(), find.item());
         if (range.is_empty())
             return false;
         outLeft  = select(range.m_from, range.m_to);
@@ -1786,7 +4742,7 @@ namespace ncore
 
     bool string_t::findStrLastSelectBeforeAndAfter(const string_t& find, string_t& outLeft, string_t& outRight) const
     {
-        nstring::range_t range = nstring::findStrUntilLast(m_item, find.m_item);
+        nstring::range_t range = nstring::findStrUntilLast(range_item(), find.item());
         if (range.is_empty())
             return false;
         outLeft  = select(range.m_from, range.m_to);
@@ -1794,6 +4750,109 @@ namespace ncore
         return true;
     }
 
-    void string_t::toAscii(char* str, s32 maxlen) const { nstring::toAscii(m_item, str, maxlen); }
+    void string_t::toAscii(char* str, s32 maxlen) const { nstring::toAscii(item(), str, maxlen); }
+
+    s32 string_t::utf8Size() const
+    {
+        nstring::instance_t const* v = item();
+        return (s32)utf8_length(v->m_data->m_ptr, v->m_range.m_from, v->m_range.m_to);
+    }
+
+    void string_t::toUtf8(char* str, s32 maxlen) const
+    {
+        if (maxlen <= 0)
+            return;
+        nstring::instance_t const* v   = item();
+        u32                        src = v->m_range.m_from;
+        u32                        dst = 0;
+        ToUtf8(v->m_data->m_ptr, src, v->m_range.m_to, (utf8::prune)str, dst, (u32)(maxlen - 1));
+        str[dst] = '\0';
+    }
+
+    //------------------------------------------------------------------------------
+    //------------------------------------------------------------------------------
+    //------------------------------------------------------------------------------
+    charset_t::charset_t()
+        : m_pages(nullptr)
+        , m_num_pages(0)
+        , m_max_pages(0)
+    {
+        clear();
+    }
+
+    charset_t::charset_t(const char* set)
+        : m_pages(nullptr)
+        , m_num_pages(0)
+        , m_max_pages(0)
+    {
+        clear();
+        add(set);
+    }
+
+    charset_t::charset_t(const string_t& set)
+        : m_pages(nullptr)
+        , m_num_pages(0)
+        , m_max_pages(0)
+    {
+        clear();
+        add(set);
+    }
+
+    charset_t::~charset_t()
+    {
+        if (m_pages != nullptr)
+            nstring_memory::s_string_alloc->deallocate(m_pages);
+    }
+
+    void charset_t::add(uchar32 c)
+    {
+        if (c < 256)
+        {
+            m_latin1[c >> 6] |= (u64)1 << (c & 63);
+            return;
+        }
+        if (c > 0xFFFF)
+            return;
+
+        s32 const hi = (s32)(c >> 8);
+        if (m_page[hi] == 0)
+        {
+            if (m_num_pages == m_max_pages)
+            {
+                s32 const max_pages = m_max_pages == 0 ? 4 : m_max_pages * 2;
+                u64*      pages     = (u64*)nstring_memory::s_string_alloc->allocate(max_pages * 4 * sizeof(u64));
+                if (m_pages != nullptr)
+                {
+                    nmem::memcpy(pages, m_pages, m_num_pages * 4 * sizeof(u64));
+                    nstring_memory::s_string_alloc->deallocate(m_pages);
+                }
+                m_pages     = pages;
+                m_max_pages = max_pages;
+            }
+            u64* page = m_pages + m_num_pages * 4;
+            page[0] = page[1] = page[2] = page[3] = 0;
+            m_page[hi]                            = (u8)(++m_num_pages);
+        }
+        m_pages[((m_page[hi] - 1) << 2) + ((c >> 6) & 3)] |= (u64)1 << (c & 63);
+    }
+
+    void charset_t::add(const char* set)
+    {
+        while (*set != '\0')
+            add((uchar32)(uchar8)*set++);
+    }
+
+    void charset_t::add(const string_t& set)
+    {
+        for (s32 i = 0; i < set.size(); ++i)
+            add(set[i]);
+    }
+
+    void charset_t::clear()
+    {
+        m_latin1[0] = m_latin1[1] = m_latin1[2] = m_latin1[3] = 0;
+        nmem::memset(m_page, 0, sizeof(m_page));
+        m_num_pages = 0;
+    }
 
 }  // namespace ncore
@@ -3,112 +3,740 @@
 #include "cbase/c_runes.h"
 
 #include "cstring/c_string.h"
+#include "cstring/c_ucs2.h"
+#include "cstring/private/c_simd.h"
 
 namespace ncore
 {
-    void utf8CharToUcs2Char(utf8::pcrune utf8Str, u32& utf8Cursor, u32 utf8Eos, ucs2::prune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos)
+    namespace nucs2
     {
-        if (ucs2Cursor >= ucs2Eos)
-            return;
+        static inline bool s_is_cont(u32 c) { return (c & 0xC0) == 0x80; }
 
-        // Initialize return values for 'return false' cases.
-        ucs2Str[ucs2Cursor] = L'?';
-        s32 utf8TokenLength   = 0;
+        // Decodes the rune at @cursor, a malformed sequence consumes one byte and a code point outside the
+        // BMP consumes all of its bytes, both decode to '?' and return false
+        static bool s_decode_rune(utf8::pcrune str, u32& cursor, u32 end, ucs2::rune& rune)
+        {
+            u32 const c = str[cursor];
+            u32 const n = end - cursor;
+            rune        = '?';
+            if (c < 0x80)
+            {
+                rune = (ucs2::rune)c;
+                cursor += 1;
+                return true;
+            }
+            else if (c >= 0xC2 && c < 0xE0)
+            {
+                if (n >= 2 && s_is_cont(str[cursor + 1]))
+                {
+                    rune = (ucs2::rune)((c & 0x1F) << 6 | (str[cursor + 1] & 0x3F));
+                    cursor += 2;
+                    return true;
+                }
+            }
+            else if (c >= 0xE0 && c < 0xF0)
+            {
+                if (n >= 3 && s_is_cont(str[cursor + 1]) && s_is_cont(str[cursor + 2]))
+                {
+                    u32 const r = (c & 0x0F) << 12 | (str[cursor + 1] & 0x3F) << 6 | (str[cursor + 2] & 0x3F);
+                    if (r >= 0x800 && (r & 0xF800) != 0xD800)  // not overlong, not a surrogate
+                    {
+                        rune = (ucs2::rune)r;
+                        cursor += 3;
+                        return true;
+                    }
+                }
+            }
+            else if (c >= 0xF0 && c < 0xF5)
+            {
+                if (n >= 4 && s_is_cont(str[cursor + 1]) && s_is_cont(str[cursor + 2]) && s_is_cont(str[cursor + 3]))
+                {
+                    u32 const r = (c & 0x07) << 18 | (str[cursor + 1] & 0x3F) << 12 | (str[cursor + 2] & 0x3F) << 6 | (str[cursor + 3] & 0x3F);
+                    if (r >= 0x10000 && r < 0x110000)
+                    {
+                        cursor += 4;  // Character exceeds the UCS-2 range (UCS-4 would be necessary)
+                        return false;
+                    }
+                }
+            }
+            cursor += 1;
+            return false;
+        }
 
-        // Decode
-        if (0x80 > utf8Str[utf8Cursor])
+        static s32 s_to_ucs2_scalar(utf8::pcrune src, u32& srcCursor, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos)
         {
-            utf8TokenLength       = 1;
-            ucs2Str[ucs2Cursor] = static_cast<uchar16>(utf8Str[utf8Cursor]);
-            ucs2Cursor++;
+            s32 replaced = 0;
+            while (dstCursor < dstEos && srcCursor < srcEnd)
+            {
+                if (!s_decode_rune(src, srcCursor, srcEnd, dst[dstCursor++]))
+                    replaced++;
+            }
+            return replaced;
         }
-        else if (0xC0 == (utf8Str[utf8Cursor] & 0xE0))
+
+        // Decodes the runes that start in the next @len bytes
+        static s32 s_to_ucs2_runes(utf8::pcrune src, u32& srcCursor, u32 len, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos)
         {
-            utf8TokenLength = 1;
-            if (0x80 != (utf8Str[utf8Cursor + 1] & 0xC0))
+            u32 const end      = srcCursor + len;
+            s32       replaced = 0;
+            while (dstCursor < dstEos && srcCursor < end)
             {
-                utf8Cursor += utf8TokenLength;
-                return;
+                if (!s_decode_rune(src, srcCursor, srcEnd, dst[dstCursor++]))
+                    replaced++;
             }
-            utf8TokenLength       = 2;
-            ucs2Str[ucs2Cursor] = static_cast<uchar16>((utf8Str[utf8Cursor] & 0x1F) << 6 | (utf8Str[utf8Cursor + 1] & 0x3F));
-            ucs2Cursor++;
+            return replaced;
         }
-        else if (0xE0 == (utf8Str[utf8Cursor] & 0xF0))
+
+#if defined(CSTRING_SIMD_SSE2) || defined(CSTRING_SIMD_NEON)
+        // A window of 12 bytes is decoded with two byte shuffles, it is selected by the mask of the bytes that
+        // end a rune (the next byte is not a continuation byte). A window takes 6 runes when these are at most
+        // 2 bytes long and 4 runes otherwise, this keeps the number of distinct windows below 256.
+        // A 16-bit lane of @m_last holds the index of the last byte of a rune and of the byte before it,
+        // @m_lead holds the index of the first byte. Unused bytes are 0x80, which shuffles in a zero.
+        struct utf8_window_t
+        {
+            u8 m_last[16];
+            u8 m_lead[16];
+            u8 m_len[8];  // length of each rune, 0 for the unused lanes
+            u8 m_in;      // bytes consumed, 0 when the first rune is longer than 3 bytes
+            u8 m_out;     // runes produced
+        };
+
+        struct utf8_windows_t
         {
-            utf8TokenLength = 1;
-            if ((0x80 != (utf8Str[utf8Cursor + 1] & 0xC0)) || (0x80 != (utf8Str[utf8Cursor + 2] & 0xC0)))
+            u8            m_index[4096];
+            utf8_window_t m_windows[256];
+
+            utf8_windows_t()
             {
-                utf8Cursor += utf8TokenLength;
-                return;
+                s16 keys[4096];  // the rune lengths in base 4 to the window that decodes them
+                for (s32 i = 0; i < 4096; ++i)
+                    keys[i] = -1;
+
+                s32 count = 0;
+                for (s32 mask = 0; mask < 4096; ++mask)
+                {
+                    s32 len[12];
+                    s32 n = 0, start = 0;
+                    for (s32 i = 0; i < 12; ++i)
+                    {
+                        if ((mask & (1 << i)) == 0)
+                            continue;
+                        if (i - start + 1 > 3)
+                            break;
+                        len[n++] = i - start + 1;
+                        start    = i + 1;
+                    }
+
+                    s32 take = n < 4 ? n : 4;
+                    if (n >= 6 && len[0] <= 2 && len[1] <= 2 && len[2] <= 2 && len[3] <= 2 && len[4] <= 2 && len[5] <= 2)
+                        take = 6;
+
+                    s32 key = 0;
+                    for (s32 r = 0; r < take; ++r)
+                        key |= len[r] << (r * 2);
+                    if (keys[key] < 0)
+                    {
+                        keys[key] = (s16)count;
+                        s_build(m_windows[count++], len, take);
+                    }
+                    m_index[mask] = (u8)keys[key];
+                }
+                ASSERT(count <= 256);
             }
-            utf8TokenLength       = 3;
-            ucs2Str[ucs2Cursor] = static_cast<uchar16>((utf8Str[utf8Cursor] & 0x0F) << 12 | (utf8Str[utf8Cursor + 1] & 0x3F) << 6 | (utf8Str[utf8Cursor + 2] & 0x3F));
-            ucs2Cursor++;
+
+            static void s_build(utf8_window_t& w, s32 const* len, s32 take)
+            {
+                for (s32 i = 0; i < 16; ++i)
+                {
+                    w.m_last[i] = 0x80;
+                    w.m_lead[i] = 0x80;
+                }
+                for (s32 i = 0; i < 8; ++i)
+                    w.m_len[i] = 0;
+
+                s32 start = 0;
+                for (s32 r = 0; r < take; ++r)
+                {
+                    s32 const last    = start + len[r] - 1;
+                    w.m_last[r * 2]     = (u8)last;
+                    w.m_last[r * 2 + 1] = len[r] >= 2 ? (u8)(last - 1) : 0x80;
+                    w.m_lead[r * 2]     = (u8)start;
+                    w.m_len[r]          = (u8)len[r];
+                    start += len[r];
+                }
+                w.m_in  = (u8)start;
+                w.m_out = (u8)take;
+            }
+        };
+
+        static const utf8_windows_t s_utf8_windows;
+#endif
+
+#if defined(CSTRING_SIMD_SSE2)
+        // While the input is ASCII 16 bytes are widened at a time, from a non-ASCII byte onwards the runes
+        // are decoded one by one until the next block
+        static s32 s_to_ucs2_sse2(utf8::pcrune src, u32& srcCursor, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            s32           replaced = 0;
+            u32           si       = srcCursor;
+            u32           di       = dstCursor;
+            __m128i const zero     = _mm_setzero_si128();
+            while (si + 16 <= srcEnd && di + 16 <= dstEos)
+            {
+                __m128i const bytes = _mm_loadu_si128((__m128i const*)(src + si));
+                _mm_storeu_si128((__m128i*)(dst + di), _mm_unpacklo_epi8(bytes, zero));
+                _mm_storeu_si128((__m128i*)(dst + di + 8), _mm_unpackhi_epi8(bytes, zero));
+                u32 const mask = (u32)_mm_movemask_epi8(bytes);
+                if (mask == 0)
+                {
+                    si += 16;
+                    di += 16;
+                    continue;
+                }
+                u32 const ascii = (u32)nsimd::ctz32(mask);
+                si += ascii;
+                di += ascii;
+                replaced += s_to_ucs2_runes(src, si, 16 - ascii, srcEnd, dst, di, dstEos);
+            }
+            srcCursor = si;
+            dstCursor = di;
+            return replaced + s_to_ucs2_scalar(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
         }
-        else if (0xF0 == (utf8Str[utf8Cursor] & 0xF8))
+
+        // Decodes and validates the runes of a window, returns false when the window has to be decoded one
+        // rune at a time (malformed input or a rune outside the BMP)
+        CSTRING_TARGET_AVX2 static inline bool s_to_ucs2_window_avx2(__m128i bytes, ucs2::prune dst, utf8_window_t const& w)
         {
-            utf8TokenLength = 4;  // Character exceeds the UCS-2 range (UCS-4 would be necessary)
+            __m128i const last = _mm_shuffle_epi8(bytes, _mm_loadu_si128((__m128i const*)w.m_last));
+            __m128i const lead = _mm_shuffle_epi8(bytes, _mm_loadu_si128((__m128i const*)w.m_lead));
+            __m128i const len  = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)w.m_len));
+            __m128i const len1 = _mm_cmpeq_epi16(len, _mm_set1_epi16(1));
+            __m128i const len2 = _mm_cmpeq_epi16(len, _mm_set1_epi16(2));
+            __m128i const len3 = _mm_cmpeq_epi16(len, _mm_set1_epi16(3));
+
+            __m128i rune = _mm_and_si128(last, _mm_set1_epi16(0x7F));
+            rune         = _mm_or_si128(rune, _mm_srli_epi16(_mm_and_si128(last, _mm_set1_epi16(0x3F00)), 2));
+            rune         = _mm_or_si128(rune, _mm_and_si128(_mm_slli_epi16(lead, 12), len3));
+
+            // The lead byte has to match the length, the rune can not be overlong or a surrogate
+            __m128i const leadmask  = _mm_or_si128(_mm_or_si128(_mm_and_si128(len1, _mm_set1_epi16(0x80)), _mm_and_si128(len2, _mm_set1_epi16(0xE0))), _mm_and_si128(len3, _mm_set1_epi16(0xF0)));
+            __m128i const leadtag   = _mm_or_si128(_mm_and_si128(len2, _mm_set1_epi16(0xC0)), _mm_and_si128(len3, _mm_set1_epi16(0xE0)));
+            __m128i const minimum   = _mm_or_si128(_mm_and_si128(len2, _mm_set1_epi16(0x80)), _mm_and_si128(len3, _mm_set1_epi16(0x800)));
+            __m128i const surrogate = _mm_cmpeq_epi16(_mm_and_si128(rune, _mm_set1_epi16((s16)0xF800)), _mm_set1_epi16((s16)0xD800));
+            __m128i       ok        = _mm_cmpeq_epi16(_mm_and_si128(lead, leadmask), leadtag);
+            ok                      = _mm_andnot_si128(surrogate, _mm_and_si128(ok, _mm_cmpeq_epi16(_mm_max_epu16(rune, minimum), rune)));
+            if (_mm_movemask_epi8(ok) != 0xFFFF)
+                return false;
+            _mm_storeu_si128((__m128i*)dst, rune);
+            return true;
         }
-        else if (0xF8 == (utf8Str[utf8Cursor] & 0xFC))
+
+        // Widens 32 bytes at a time while the input is ASCII, other runes are decoded a window at a time
+        CSTRING_TARGET_AVX2 static s32 s_to_ucs2_avx2(utf8::pcrune src, u32& srcCursor, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos)
         {
-            utf8TokenLength = 5;  // Character exceeds the UCS-2 range (UCS-4 would be necessary)
+            s32 replaced = 0;
+            u32 si       = srcCursor;
+            u32 di       = dstCursor;
+            while (si + 32 <= srcEnd && di + 32 <= dstEos)
+            {
+                __m256i const bytes = _mm256_loadu_si256((__m256i const*)(src + si));
+                if (_mm256_movemask_epi8(bytes) != 0)
+                    break;
+                _mm256_storeu_si256((__m256i*)(dst + di), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+                _mm256_storeu_si256((__m256i*)(dst + di + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+                si += 32;
+                di += 32;
+            }
+
+            while (si + 16 <= srcEnd && di + 16 <= dstEos)
+            {
+                __m128i const bytes = _mm_loadu_si128((__m128i const*)(src + si));
+                u32 const     mask  = (u32)_mm_movemask_epi8(bytes);
+                if ((mask & 1) == 0)
+                {
+                    // Widen the ASCII bytes up to the first rune that is not
+                    _mm256_storeu_si256((__m256i*)(dst + di), _mm256_cvtepu8_epi16(bytes));
+                    u32 const ascii = mask == 0 ? 16 : (u32)nsimd::ctz32(mask);
+                    si += ascii;
+                    di += ascii;
+                    continue;
+                }
+
+                __m128i const        next = _mm_srli_si128(bytes, 1);
+                __m128i const        cont = _mm_cmpeq_epi8(_mm_and_si128(next, _mm_set1_epi8((s8)0xC0)), _mm_set1_epi8((s8)0x80));
+                u32 const            ends = ~(u32)_mm_movemask_epi8(cont) & 0xFFF;
+                utf8_window_t const& w    = s_utf8_windows.m_windows[s_utf8_windows.m_index[ends]];
+                if (w.m_in != 0 && s_to_ucs2_window_avx2(bytes, dst + di, w))
+                {
+                    si += w.m_in;
+                    di += w.m_out;
+                }
+                else
+                {
+                    replaced += s_to_ucs2_runes(src, si, w.m_in != 0 ? w.m_in : 1, srcEnd, dst, di, dstEos);
+                }
+            }
+            srcCursor = si;
+            dstCursor = di;
+            return replaced + s_to_ucs2_scalar(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
         }
-        else if (0xFC == (utf8Str[utf8Cursor] & 0xFE))
+#elif defined(CSTRING_SIMD_NEON)
+        static inline bool s_to_ucs2_window_neon(uint8x16_t bytes, ucs2::prune dst, utf8_window_t const& w)
         {
-            utf8TokenLength = 6;  // Character exceeds the UCS-2 range (UCS-4 would be necessary)
+            uint16x8_t const last = vreinterpretq_u16_u8(vqtbl1q_u8(bytes, vld1q_u8(w.m_last)));
+            uint16x8_t const lead = vreinterpretq_u16_u8(vqtbl1q_u8(bytes, vld1q_u8(w.m_lead)));
+            uint16x8_t const len  = vmovl_u8(vld1_u8(w.m_len));
+            uint16x8_t const len1 = vceqq_u16(len, vdupq_n_u16(1));
+            uint16x8_t const len2 = vceqq_u16(len, vdupq_n_u16(2));
+            uint16x8_t const len3 = vceqq_u16(len, vdupq_n_u16(3));
+
+            uint16x8_t rune = vandq_u16(last, vdupq_n_u16(0x7F));
+            rune            = vorrq_u16(rune, vshrq_n_u16(vandq_u16(last, vdupq_n_u16(0x3F00)), 2));
+            rune            = vorrq_u16(rune, vandq_u16(vshlq_n_u16(lead, 12), len3));
+
+            // The lead byte has to match the length, the rune can not be overlong or a surrogate
+            uint16x8_t const leadmask  = vorrq_u16(vorrq_u16(vandq_u16(len1, vdupq_n_u16(0x80)), vandq_u16(len2, vdupq_n_u16(0xE0))), vandq_u16(len3, vdupq_n_u16(0xF0)));
+            uint16x8_t const leadtag   = vorrq_u16(vandq_u16(len2, vdupq_n_u16(0xC0)), vandq_u16(len3, vdupq_n_u16(0xE0)));
+            uint16x8_t const minimum   = vorrq_u16(vandq_u16(len2, vdupq_n_u16(0x80)), vandq_u16(len3, vdupq_n_u16(0x800)));
+            uint16x8_t const surrogate = vceqq_u16(vandq_u16(rune, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800));
+            uint16x8_t       ok        = vceqq_u16(vandq_u16(lead, leadmask), leadtag);
+            ok                         = vbicq_u16(vandq_u16(ok, vcgeq_u16(rune, minimum)), surrogate);
+            if (vminvq_u16(ok) != 0xFFFF)
+                return false;
+            vst1q_u16(dst, rune);
+            return true;
         }
-        utf8Cursor += utf8TokenLength;
-    }
 
-    void ucs2CharToUtf8Char(ucs2::pcrune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos, utf8::prune utf8Str, u32& utf8Cursor, u32 utf8Eos)
-    {
-        u32 ucs2CharValue = ucs2Str[ucs2Cursor];
+        static s32 s_to_ucs2_neon(utf8::pcrune src, u32& srcCursor, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            static const u8 c_bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+
+            s32              replaced = 0;
+            u32              si       = srcCursor;
+            u32              di       = dstCursor;
+            uint8x16_t const bits     = vld1q_u8(c_bits);
+            while (si + 16 <= srcEnd && di + 16 <= dstEos)
+            {
+                uint8x16_t const bytes = vld1q_u8(src + si);
+                if (vmaxvq_u8(bytes) < 0x80)
+                {
+                    vst1q_u16(dst + di, vmovl_u8(vget_low_u8(bytes)));
+                    vst1q_u16(dst + di + 8, vmovl_high_u8(bytes));
+                    si += 16;
+                    di += 16;
+                    continue;
+                }
+
+                uint8x16_t const     next = vextq_u8(bytes, vdupq_n_u8(0), 1);
+                uint8x16_t const     end  = vandq_u8(vmvnq_u8(vceqq_u8(vandq_u8(next, vdupq_n_u8(0xC0)), vdupq_n_u8(0x80))), bits);
+                u32 const            ends = ((u32)vaddv_u8(vget_low_u8(end)) | (u32)vaddv_u8(vget_high_u8(end)) << 8) & 0xFFF;
+                utf8_window_t const& w    = s_utf8_windows.m_windows[s_utf8_windows.m_index[ends]];
+                if (w.m_in != 0 && s_to_ucs2_window_neon(bytes, dst + di, w))
+                {
+                    si += w.m_in;
+                    di += w.m_out;
+                }
+                else
+                {
+                    replaced += s_to_ucs2_runes(src, si, w.m_in != 0 ? w.m_in : 1, srcEnd, dst, di, dstEos);
+                }
+            }
+            srcCursor = si;
+            dstCursor = di;
+            return replaced + s_to_ucs2_scalar(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
+        }
+#endif
 
-        // Decode
-        if (0x80 > ucs2CharValue)
+        typedef s32 (*to_ucs2_fn)(utf8::pcrune src, u32& srcCursor, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos);
+
+        static s32 s_to_ucs2_impl(utf8::pcrune src, u32& srcCursor, u32 srcEnd, ucs2::prune dst, u32& dstCursor, u32 dstEos)
         {
-            // Tokensize: 1 byte
-            utf8Str[utf8Cursor + 1] = static_cast<unsigned char>(ucs2CharValue);
-            utf8Str[utf8Cursor + 0] = '\0';
-            utf8Cursor += 1;
+            static to_ucs2_fn const s_fn = CSTRING_SIMD_SELECT(s_to_ucs2);
+            return s_fn(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
         }
-        else if (0x800 > ucs2CharValue)
+
+        // The number of runes is the number of bytes that are not continuation bytes
+        static u32 s_ucs2_length_scalar(utf8::pcrune str, u32 len)
         {
-            // Tokensize: 2 bytes
-            utf8Str[utf8Cursor + 2] = '\0';
-            utf8Str[utf8Cursor + 1] = static_cast<unsigned char>(0x80 | (ucs2CharValue & 0x3F));
-            ucs2CharValue             = (ucs2CharValue >> 6);
-            utf8Str[utf8Cursor + 0] = static_cast<unsigned char>(0xC0 | ucs2CharValue);
-            utf8Cursor += 2;
+            u32 runes = 0;
+            for (u32 i = 0; i < len; ++i)
+                runes += s_is_cont(str[i]) ? 0 : 1;
+            return runes;
         }
-        else
+
+#if defined(CSTRING_SIMD_SSE2)
+        // A byte is 1 when it starts a rune, _mm_sad_epu8 adds them up per 8 bytes
+        static u32 s_ucs2_length_sse2(utf8::pcrune str, u32 len)
         {
-            // Tokensize: 3 bytes
-            utf8Str[utf8Cursor + 3] = '\0';
-            utf8Str[utf8Cursor + 2] = static_cast<unsigned char>(0x80 | (ucs2CharValue & 0x3F));
-            ucs2CharValue             = (ucs2CharValue >> 6);
-            utf8Str[utf8Cursor + 1] = static_cast<unsigned char>(0x80 | (ucs2CharValue & 0x3F));
-            ucs2CharValue             = (ucs2CharValue >> 6);
-            utf8Str[utf8Cursor + 0] = static_cast<unsigned char>(0xE0 | ucs2CharValue);
-            utf8Cursor += 3;
+            __m128i const c_one = _mm_set1_epi8(1);
+            __m128i       acc   = _mm_setzero_si128();
+            u32           i     = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m128i const bytes = _mm_loadu_si128((__m128i const*)(str + i));
+                __m128i const cont  = _mm_cmpeq_epi8(_mm_and_si128(bytes, _mm_set1_epi8((s8)0xC0)), _mm_set1_epi8((s8)0x80));
+                acc                 = _mm_add_epi64(acc, _mm_sad_epu8(_mm_andnot_si128(cont, c_one), _mm_setzero_si128()));
+            }
+            u64 lanes[2];
+            _mm_storeu_si128((__m128i*)lanes, acc);
+            return (u32)(lanes[0] + lanes[1]) + s_ucs2_length_scalar(str + i, len - i);
         }
-    }
 
-    void ToUcs2(utf8::pcrune utf8Str, u32& utf8Cursor, u32 utf8End, ucs2::prune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos)
-    {
-        while (ucs2Cursor < ucs2Eos && utf8Cursor < utf8End)
+        CSTRING_TARGET_AVX2 static u32 s_ucs2_length_avx2(utf8::pcrune str, u32 len)
+        {
+            __m256i const c_one = _mm256_set1_epi8(1);
+            __m256i       acc   = _mm256_setzero_si256();
+            u32           i     = 0;
+            for (; i + 32 <= len; i += 32)
+            {
+                __m256i const bytes = _mm256_loadu_si256((__m256i const*)(str + i));
+                __m256i const cont  = _mm256_cmpeq_epi8(_mm256_and_si256(bytes, _mm256_set1_epi8((s8)0xC0)), _mm256_set1_epi8((s8)0x80));
+                acc                 = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_andnot_si256(cont, c_one), _mm256_setzero_si256()));
+            }
+            u64 lanes[4];
+            _mm256_storeu_si256((__m256i*)lanes, acc);
+            return (u32)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + s_ucs2_length_scalar(str + i, len - i);
+        }
+#elif defined(CSTRING_SIMD_NEON)
+        static u32 s_ucs2_length_neon(utf8::pcrune str, u32 len)
+        {
+            uint32x4_t acc = vdupq_n_u32(0);
+            u32        i   = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                uint8x16_t const bytes = vld1q_u8(str + i);
+                uint8x16_t const lead  = vshrq_n_u8(vmvnq_u8(vceqq_u8(vandq_u8(bytes, vdupq_n_u8(0xC0)), vdupq_n_u8(0x80))), 7);
+                acc                    = vpadalq_u16(acc, vpaddlq_u8(lead));
+            }
+            return vaddvq_u32(acc) + s_ucs2_length_scalar(str + i, len - i);
+        }
+#endif
+
+        typedef u32 (*ucs2_length_fn)(utf8::pcrune str, u32 len);
+
+        static u32 s_ucs2_length_impl(utf8::pcrune str, u32 len)
         {
-            utf8CharToUcs2Char(utf8Str, utf8Cursor, utf8End, ucs2Str, ucs2Cursor, ucs2Eos);
+            static ucs2_length_fn const s_fn = CSTRING_SIMD_SELECT(s_ucs2_length);
+            return s_fn(str, len);
         }
+
+        // Encodes @rune when it fits in [cursor, eos), no terminator is written
+        static inline bool s_encode_rune(u32 rune, utf8::prune dst, u32& cursor, u32 eos)
+        {
+            if (rune < 0x80)
+            {
+                if (cursor + 1 > eos)
+                    return false;
+                dst[cursor] = (utf8::rune)rune;
+                cursor += 1;
+            }
+            else if (rune < 0x800)
+            {
+                if (cursor + 2 > eos)
+                    return false;
+                dst[cursor + 0] = (utf8::rune)(0xC0 | (rune >> 6));
+                dst[cursor + 1] = (utf8::rune)(0x80 | (rune & 0x3F));
+                cursor += 2;
+            }
+            else
+            {
+                if (cursor + 3 > eos)
+                    return false;
+                dst[cursor + 0] = (utf8::rune)(0xE0 | (rune >> 12));
+                dst[cursor + 1] = (utf8::rune)(0x80 | ((rune >> 6) & 0x3F));
+                dst[cursor + 2] = (utf8::rune)(0x80 | (rune & 0x3F));
+                cursor += 3;
+            }
+            return true;
+        }
+
+        static void s_to_utf8_scalar(ucs2::pcrune src, u32& srcCursor, u32 srcEnd, utf8::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            while (srcCursor < srcEnd && s_encode_rune(src[srcCursor], dst, dstCursor, dstEos))
+                srcCursor++;
+        }
+
+        // Encodes the next @len runes
+        static void s_to_utf8_runes(ucs2::pcrune src, u32& srcCursor, u32 len, utf8::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            u32 const end = srcCursor + len;
+            while (srcCursor < end && s_encode_rune(src[srcCursor], dst, dstCursor, dstEos))
+                srcCursor++;
+        }
+
+        static u32 s_utf8_length_scalar(ucs2::pcrune str, u32 len)
+        {
+            u32 size = len;
+            for (u32 i = 0; i < len; ++i)
+                size += (str[i] >= 0x80 ? 1 : 0) + (str[i] >= 0x800 ? 1 : 0);
+            return size;
+        }
+
+#if defined(CSTRING_SIMD_SSE2) || defined(CSTRING_SIMD_NEON)
+        // Four runes are encoded in 32-bit lanes and compacted with a byte shuffle, the shuffle is selected by
+        // the mask of the runes that are at least 0x80 (bits 0-3) and at least 0x800 (bits 4-7)
+        struct utf8_quad_t
+        {
+            u8 m_shuffle[16];
+            u8 m_len;
+        };
+
+        struct utf8_quads_t
+        {
+            utf8_quad_t m_quads[256];
+
+            utf8_quads_t()
+            {
+                for (s32 mask = 0; mask < 256; ++mask)
+                {
+                    utf8_quad_t& q   = m_quads[mask];
+                    s32          len = 0;
+                    for (s32 r = 0; r < 4; ++r)
+                    {
+                        s32 const n = 1 + ((mask >> r) & 1) + ((mask >> (r + 4)) & 1);
+                        for (s32 b = 0; b < n; ++b)
+                            q.m_shuffle[len++] = (u8)(r * 4 + b);
+                    }
+                    q.m_len = (u8)len;
+                    while (len < 16)
+                        q.m_shuffle[len++] = 0x80;
+                }
+            }
+        };
+
+        static const utf8_quads_t s_utf8_quads;
+#endif
+
+#if defined(CSTRING_SIMD_SSE2)
+        // The runes of a block are narrowed to bytes, the ones up to the first rune that is not ASCII are kept
+        // and from there the runes are encoded one by one until the next block
+        static void s_to_utf8_sse2(ucs2::pcrune src, u32& srcCursor, u32 srcEnd, utf8::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            u32           si     = srcCursor;
+            u32           di     = dstCursor;
+            __m128i const c_high = _mm_set1_epi16((s16)0xFF80);
+            while (si + 16 <= srcEnd && di + 16 <= dstEos)
+            {
+                __m128i const lo       = _mm_loadu_si128((__m128i const*)(src + si));
+                __m128i const hi       = _mm_loadu_si128((__m128i const*)(src + si + 8));
+                __m128i const is_ascii = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(lo, c_high), _mm_setzero_si128()), _mm_cmpeq_epi16(_mm_and_si128(hi, c_high), _mm_setzero_si128()));
+                _mm_storeu_si128((__m128i*)(dst + di), _mm_packus_epi16(lo, hi));
+                u32 const mask = ~(u32)_mm_movemask_epi8(is_ascii) & 0xFFFF;
+                if (mask == 0)
+                {
+                    si += 16;
+                    di += 16;
+                    continue;
+                }
+                u32 const ascii = (u32)nsimd::ctz32(mask);
+                si += ascii;
+                di += ascii;
+                u32 const start = si;
+                s_to_utf8_runes(src, si, 16 - ascii, dst, di, dstEos);
+                if (si - start < 16 - ascii)
+                    break;  // the output is full
+            }
+            srcCursor = si;
+            dstCursor = di;
+            s_to_utf8_scalar(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
+        }
+
+        // A lane is 1 + (rune >= 0x80) + (rune >= 0x800), the compares give -1 so they are subtracted
+        static u32 s_utf8_length_sse2(ucs2::pcrune str, u32 len)
+        {
+            __m128i const c_one = _mm_set1_epi16(-1);
+            __m128i       acc   = _mm_setzero_si128();
+            u32           i     = 0;
+            for (; i + 8 <= len; i += 8)
+            {
+                __m128i const r  = _mm_loadu_si128((__m128i const*)(str + i));
+                __m128i const a1 = _mm_cmpeq_epi16(_mm_and_si128(r, _mm_set1_epi16((s16)0xFF80)), _mm_setzero_si128());
+                __m128i const a2 = _mm_cmpeq_epi16(_mm_and_si128(r, _mm_set1_epi16((s16)0xF800)), _mm_setzero_si128());
+                acc              = _mm_add_epi32(acc, _mm_madd_epi16(_mm_add_epi16(a1, a2), c_one));
+            }
+            u32 lanes[4];
+            _mm_storeu_si128((__m128i*)lanes, acc);
+            u32 const extra = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            return 3 * i - extra + s_utf8_length_scalar(str + i, len - i);
+        }
+
+        // Encodes 4 runes held in 32-bit lanes, writes 16 bytes and returns the number of bytes used
+        CSTRING_TARGET_AVX2 static inline u32 s_to_utf8_quad_avx2(__m128i rune, utf8::prune dst)
+        {
+            __m128i const two   = _mm_cmpgt_epi32(rune, _mm_set1_epi32(0x7F));
+            __m128i const three = _mm_cmpgt_epi32(rune, _mm_set1_epi32(0x7FF));
+            __m128i const last  = _mm_or_si128(_mm_set1_epi32(0x80), _mm_and_si128(rune, _mm_set1_epi32(0x3F)));
+            __m128i const mid   = _mm_or_si128(_mm_set1_epi32(0x80), _mm_and_si128(_mm_srli_epi32(rune, 6), _mm_set1_epi32(0x3F)));
+            __m128i const enc2  = _mm_or_si128(_mm_or_si128(_mm_set1_epi32(0xC0), _mm_srli_epi32(rune, 6)), _mm_slli_epi32(last, 8));
+            __m128i const enc3  = _mm_or_si128(_mm_or_si128(_mm_set1_epi32(0xE0), _mm_srli_epi32(rune, 12)), _mm_or_si128(_mm_slli_epi32(mid, 8), _mm_slli_epi32(last, 16)));
+            __m128i const bytes = _mm_blendv_epi8(_mm_blendv_epi8(rune, enc2, two), enc3, three);
+
+            u32 const          mask = (u32)_mm_movemask_ps(_mm_castsi128_ps(two)) | (u32)_mm_movemask_ps(_mm_castsi128_ps(three)) << 4;
+            utf8_quad_t const& q    = s_utf8_quads.m_quads[mask];
+            _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(bytes, _mm_loadu_si128((__m128i const*)q.m_shuffle)));
+            return q.m_len;
+        }
+
+        // Blocks of 16 ASCII runes are narrowed at once, other blocks are encoded 4 runes at a time
+        CSTRING_TARGET_AVX2 static void s_to_utf8_avx2(ucs2::pcrune src, u32& srcCursor, u32 srcEnd, utf8::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            u32           si     = srcCursor;
+            u32           di     = dstCursor;
+            __m256i const c_high = _mm256_set1_epi16((s16)0xFF80);
+            while (si + 16 <= srcEnd && di + 64 <= dstEos)
+            {
+                __m256i const runes = _mm256_loadu_si256((__m256i const*)(src + si));
+                __m128i const lo    = _mm256_castsi256_si128(runes);
+                __m128i const hi    = _mm256_extracti128_si256(runes, 1);
+                if (_mm256_testz_si256(runes, c_high))
+                {
+                    _mm_storeu_si128((__m128i*)(dst + di), _mm_packus_epi16(lo, hi));
+                    si += 16;
+                    di += 16;
+                    continue;
+                }
+                di += s_to_utf8_quad_avx2(_mm_cvtepu16_epi32(lo), dst + di);
+                di += s_to_utf8_quad_avx2(_mm_cvtepu16_epi32(_mm_srli_si128(lo, 8)), dst + di);
+                di += s_to_utf8_quad_avx2(_mm_cvtepu16_epi32(hi), dst + di);
+                di += s_to_utf8_quad_avx2(_mm_cvtepu16_epi32(_mm_srli_si128(hi, 8)), dst + di);
+                si += 16;
+            }
+            srcCursor = si;
+            dstCursor = di;
+            s_to_utf8_scalar(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
+        }
+
+        CSTRING_TARGET_AVX2 static u32 s_utf8_length_avx2(ucs2::pcrune str, u32 len)
+        {
+            __m256i const c_one = _mm256_set1_epi16(-1);
+            __m256i       acc   = _mm256_setzero_si256();
+            u32           i     = 0;
+            for (; i + 16 <= len; i += 16)
+            {
+                __m256i const r  = _mm256_loadu_si256((__m256i const*)(str + i));
+                __m256i const a1 = _mm256_cmpeq_epi16(_mm256_and_si256(r, _mm256_set1_epi16((s16)0xFF80)), _mm256_setzero_si256());
+                __m256i const a2 = _mm256_cmpeq_epi16(_mm256_and_si256(r, _mm256_set1_epi16((s16)0xF800)), _mm256_setzero_si256());
+                acc              = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_add_epi16(a1, a2), c_one));
+            }
+            u32 lanes[8];
+            _mm256_storeu_si256((__m256i*)lanes, acc);
+            u32 const extra = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+            return 3 * i - extra + s_utf8_length_scalar(str + i, len - i);
+        }
+#elif defined(CSTRING_SIMD_NEON)
+        static inline u32 s_to_utf8_quad_neon(uint32x4_t rune, utf8::prune dst)
+        {
+            static const u32 c_bits[4] = {1, 2, 4, 8};
+
+            uint32x4_t const two   = vcgtq_u32(rune, vdupq_n_u32(0x7F));
+            uint32x4_t const three = vcgtq_u32(rune, vdupq_n_u32(0x7FF));
+            uint32x4_t const last  = vorrq_u32(vdupq_n_u32(0x80), vandq_u32(rune, vdupq_n_u32(0x3F)));
+            uint32x4_t const mid   = vorrq_u32(vdupq_n_u32(0x80), vandq_u32(vshrq_n_u32(rune, 6), vdupq_n_u32(0x3F)));
+            uint32x4_t const enc2  = vorrq_u32(vorrq_u32(vdupq_n_u32(0xC0), vshrq_n_u32(rune, 6)), vshlq_n_u32(last, 8));
+            uint32x4_t const enc3  = vorrq_u32(vorrq_u32(vdupq_n_u32(0xE0), vshrq_n_u32(rune, 12)), vorrq_u32(vshlq_n_u32(mid, 8), vshlq_n_u32(last, 16)));
+            uint32x4_t const bytes = vbslq_u32(three, enc3, vbslq_u32(two, enc2, rune));
+
+            uint32x4_t const   bits = vld1q_u32(c_bits);
+            u32 const          mask = vaddvq_u32(vandq_u32(two, bits)) | vaddvq_u32(vandq_u32(three, bits)) << 4;
+            utf8_quad_t const& q    = s_utf8_quads.m_quads[mask];
+            vst1q_u8(dst, vqtbl1q_u8(vreinterpretq_u8_u32(bytes), vld1q_u8(q.m_shuffle)));
+            return q.m_len;
+        }
+
+        static void s_to_utf8_neon(ucs2::pcrune src, u32& srcCursor, u32 srcEnd, utf8::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            u32 si = srcCursor;
+            u32 di = dstCursor;
+            while (si + 16 <= srcEnd && di + 64 <= dstEos)
+            {
+                uint16x8_t const lo = vld1q_u16(src + si);
+                uint16x8_t const hi = vld1q_u16(src + si + 8);
+                if (vmaxvq_u16(vorrq_u16(lo, hi)) < 0x80)
+                {
+                    vst1q_u8(dst + di, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+                    si += 16;
+                    di += 16;
+                    continue;
+                }
+                di += s_to_utf8_quad_neon(vmovl_u16(vget_low_u16(lo)), dst + di);
+                di += s_to_utf8_quad_neon(vmovl_high_u16(lo), dst + di);
+                di += s_to_utf8_quad_neon(vmovl_u16(vget_low_u16(hi)), dst + di);
+                di += s_to_utf8_quad_neon(vmovl_high_u16(hi), dst + di);
+                si += 16;
+            }
+            srcCursor = si;
+            dstCursor = di;
+            s_to_utf8_scalar(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
+        }
+
+        static u32 s_utf8_length_neon(ucs2::pcrune str, u32 len)
+        {
+            uint32x4_t acc = vdupq_n_u32(0);
+            u32        i   = 0;
+            for (; i + 8 <= len; i += 8)
+            {
+                uint16x8_t const r = vld1q_u16(str + i);
+                uint16x8_t const n = vaddq_u16(vshrq_n_u16(vcgeq_u16(r, vdupq_n_u16(0x80)), 15), vshrq_n_u16(vcgeq_u16(r, vdupq_n_u16(0x800)), 15));
+                acc                = vpadalq_u16(acc, n);
+            }
+            return i + vaddvq_u32(acc) + s_utf8_length_scalar(str + i, len - i);
+        }
+#endif
+
+        typedef void (*to_utf8_fn)(ucs2::pcrune src, u32& srcCursor, u32 srcEnd, utf8::prune dst, u32& dstCursor, u32 dstEos);
+        typedef u32 (*utf8_length_fn)(ucs2::pcrune str, u32 len);
+
+        static void s_to_utf8_impl(ucs2::pcrune src, u32& srcCursor, u32 srcEnd, utf8::prune dst, u32& dstCursor, u32 dstEos)
+        {
+            static to_utf8_fn const s_fn = CSTRING_SIMD_SELECT(s_to_utf8);
+            s_fn(src, srcCursor, srcEnd, dst, dstCursor, dstEos);
+        }
+
+        static u32 s_utf8_length_impl(ucs2::pcrune str, u32 len)
+        {
+            static utf8_length_fn const s_fn = CSTRING_SIMD_SELECT(s_utf8_length);
+            return s_fn(str, len);
+        }
+    }  // namespace nucs2
+
+    bool utf8CharToUcs2Char(utf8::pcrune utf8Str, u32& utf8Cursor, u32 utf8Eos, ucs2::prune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos)
+    {
+        if (ucs2Cursor >= ucs2Eos || utf8Cursor >= utf8Eos)
+            return true;
+        return nucs2::s_decode_rune(utf8Str, utf8Cursor, utf8Eos, ucs2Str[ucs2Cursor++]);
+    }
+
+    bool ucs2CharToUtf8Char(ucs2::pcrune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos, utf8::prune utf8Str, u32& utf8Cursor, u32 utf8Eos)
+    {
+        if (ucs2Cursor >= ucs2Eos || !nucs2::s_encode_rune(ucs2Str[ucs2Cursor], utf8Str, utf8Cursor, utf8Eos))
+            return false;
+        ucs2Cursor++;
+        return true;
+    }
+
+    s32 ToUcs2(utf8::pcrune utf8Str, u32& utf8Cursor, u32 utf8End, ucs2::prune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos)
+    {
+        return nucs2::s_to_ucs2_impl(utf8Str, utf8Cursor, utf8End, ucs2Str, ucs2Cursor, ucs2Eos);
+    }
+
+    u32 ucs2_length(utf8::pcrune utf8Str, u32 utf8Cursor, u32 utf8End)
+    {
+        if (utf8Cursor >= utf8End)
+            return 0;
+        return nucs2::s_ucs2_length_impl(utf8Str + utf8Cursor, utf8End - utf8Cursor);
     }
 
     void ToUtf8(ucs2::pcrune ucs2Str, u32& ucs2Cursor, u32 ucs2End, utf8::prune utf8Str, u32& utf8Cursor, u32 utf8Eos)
     {
-        while (ucs2Cursor < ucs2End && utf8Cursor < utf8Eos)
-        {
-            ucs2CharToUtf8Char(ucs2Str, ucs2Cursor, ucs2End, utf8Str, utf8Cursor, utf8Eos);
-        }
+        nucs2::s_to_utf8_impl(ucs2Str, ucs2Cursor, ucs2End, utf8Str, utf8Cursor, utf8Eos);
+    }
+
+    u32 utf8_length(ucs2::pcrune ucs2Str, u32 ucs2Cursor, u32 ucs2End)
+    {
+        if (ucs2Cursor >= ucs2End)
+            return 0;
+        return nucs2::s_utf8_length_impl(ucs2Str + ucs2Cursor, ucs2End - ucs2Cursor);
     }
 
 }  // namespace ncore
@@ -19,16 +19,47 @@ namespace ncore
 
     namespace nstring_memory
     {
+        // When no object allocator is given the built-in slab allocator is used, it takes its pages
+        // from the string allocator.
         void init(alloc_t* object_alloc = nullptr, alloc_t* string_alloc = nullptr);
+        void exit();
+
+        // While an arena scope is active all new strings are bump-allocated from it, releasing them
+        // does nothing and all the memory is released at once when the scope ends. A string that
+        // needs to outlive the scope should be moved to the heap with string_t::promote().
+        class arena_scope_t
+        {
+        public:
+            arena_scope_t(u32 block_size = 64 * 1024);
+            ~arena_scope_t();
+
+            void* allocate(u32 size, u32 alignment);
+            bool  owns(void const* ptr) const;
+
+            arena_scope_t* outer() const { return m_outer; }
+
+        private:
+            struct block_t;
+            arena_scope_t* m_outer;
+            block_t*       m_block;
+            u32            m_block_size;
+        };
     }
 
+    class charset_t;
+
+    // When the library is built with CSTRING_THREAD_SAFE defined as 1, views of the same string can be
+    // created, read and released from different threads. Modifying a string still requires that no other
+    // thread is using a view of it.
     class string_t
     {
     public:
         string_t();
         string_t(const char* str);
+        string_t(const char* utf8, s32 len);  // decodes @len bytes of UTF-8, see ToUcs2 for malformed input
         string_t(s32 _len);
         string_t(const string_t& other);
+        string_t(string_t&& other);
         string_t(const string_t& other, const string_t& concat);
         ~string_t();
 
@@ -36,22 +67,37 @@ namespace ncore
         s32  size() const;
         bool is_slice() const;
         bool is_empty() const;
-
+        bool is_frozen() const;
+        bool is_interned() const;
+        u64  hash() const;  // equal strings have equal hashes, the hash of a whole string is cached until it is modified
+
+        void     reserve(s32 len);
+        void     shrink_to_fit();
+        void     promote();  // move a string created in an arena scope to the heap (views are not kept)
+        void     flatten();  // make the runes of a string that is being edited contiguous again
+        void     freeze();   // make the data immutable, its views are no longer tracked and modifying one first copies its runes
+        void     intern();   // share the frozen data of every interned string with the same runes, interned strings compare in O(1)
         void     clear();
         string_t slice() const;
-        string_t clone() const;
+        string_t clone() const;  // copy that shares the runes until either string is modified
 
         string_t operator()(s32 from, s32 to) const;
         uchar32  operator[](s32 index) const;
 
         string_t& operator=(const char* other);
+        string_t& assign_utf8(const char* utf8, s32 len);
         string_t& operator=(const string_t& other);
+        string_t& operator=(string_t&& other);
         string_t& operator+=(const string_t& other);
 
         bool operator==(const string_t& other) const;
         bool operator!=(const string_t& other) const;
+        bool operator<(const string_t& other) const;
+        bool operator<=(const string_t& other) const;
+        bool operator>(const string_t& other) const;
+        bool operator>=(const string_t& other) const;
 
-        s32  compare(const string_t& rhs) const;
+        s32  compare(const string_t& rhs) const;  // lexicographic order of the runes
         bool isEqual(const string_t& rhs) const;
         bool contains(uchar32 contains) const;
         bool contains(const string_t& contains) const;
@@ -102,14 +148,19 @@ namespace ncore
         string_t find(const string_t& find) const;
         string_t findLast(const string_t& find) const;
         string_t findOneOf(const string_t& find) const;
+        string_t findOneOf(const charset_t& find) const;
         string_t findOneOfLast(const string_t& find) const;
+        string_t findOneOfLast(const charset_t& find) const;
         s32      findRemove(const string_t& find, s32 ntimes = 1);
         s32      findReplace(const string_t& find, const string_t& replace, s32 ntimes = 1);
+        s32      findReplaceAll(const string_t& find, const string_t& replace);
 
         void removeSelection(const string_t& selection);
         s32  removeChar(uchar32 c, s32 ntimes = 0);
         s32  removeAnyChar(const string_t& any, s32 ntimes = 0);
+        s32  removeAnyChar(const charset_t& any, s32 ntimes = 0);
         s32  replaceAnyChar(const string_t& any, uchar32 with, s32 ntimes = 0);
+        s32  replaceAnyChar(const charset_t& any, uchar32 with, s32 ntimes = 0);
 
         bool isUpper() const;
         bool isLower() const;
@@ -131,6 +182,7 @@ namespace ncore
         void toLower();
         void capitalize();
         void capitalize(const string_t& seperators);
+        void capitalize(const charset_t& seperators);
 
         // Trimming
         void trim();
@@ -142,6 +194,9 @@ namespace ncore
         void trim(const string_t& charSet);
         void trimLeft(const string_t& charSet);
         void trimRight(const string_t& charSet);
+        void trim(const charset_t& charSet);
+        void trimLeft(const charset_t& charSet);
+        void trimRight(const charset_t& charSet);
         void trimQuotes();
         void trimQuotes(uchar32 quote);
         void trimDelimiters(uchar32 left, uchar32 right);
@@ -154,15 +209,58 @@ namespace ncore
 
         void toAscii(char* str, s32 maxlen) const;
 
+        // UTF-8 export, utf8Size() is the exact number of bytes toUtf8() writes without the terminator
+        s32  utf8Size() const;
+        void toUtf8(char* str, s32 maxlen) const;
+
     protected:
         string_t(nstring::instance_t* item, s32 weird);
         string_t(nstring::instance_t* item, s32 from, s32 to, s32 weird);
 
-        void release();
+        void                 release();
+        s32                  make_writable();
+        nstring::instance_t* item() const;
+        nstring::instance_t* range_item() const;
 
         mutable nstring::instance_t* m_item;
     };
 
+    // A set of runes, build it once and pass it to the methods that take a set of characters so that
+    // testing a rune is a single bit test. U+0000 - U+00FF are held inline, for the rest of the BMP a
+    // page of 256 runes is allocated when the first rune of that page is added.
+    class charset_t
+    {
+    public:
+        charset_t();
+        charset_t(const char* set);
+        charset_t(const string_t& set);
+        ~charset_t();
+
+        void add(uchar32 c);
+        void add(const char* set);
+        void add(const string_t& set);
+        void clear();
+
+        inline bool contains(uchar32 c) const
+        {
+            if (c < 256)
+                return ((m_latin1[c >> 6] >> (c & 63)) & 1) != 0;
+            if (c > 0xFFFF || m_page[c >> 8] == 0)
+                return false;
+            return ((m_pages[((m_page[c >> 8] - 1) << 2) + ((c >> 6) & 3)] >> (c & 63)) & 1) != 0;
+        }
+
+    private:
+        charset_t(const charset_t&)            = delete;
+        charset_t& operator=(const charset_t&) = delete;
+
+        u64  m_latin1[4];  // the first 128 bits are the ASCII bitmap
+        u8   m_page[256];  // per high byte of a rune the index + 1 of its page in m_pages, 0 means empty
+        u64* m_pages;      // 4 x u64 per page
+        s32  m_num_pages;
+        s32  m_max_pages;
+    };
+
 }  // namespace ncore
 
 #endif
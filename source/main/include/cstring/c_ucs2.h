@@ -0,0 +1,29 @@
+#ifndef __CSTRING_UCS2_H__
+#define __CSTRING_UCS2_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+#include "cbase/c_runes.h"
+
+namespace ncore
+{
+    // Transcodes the UTF-8 in utf8Str[utf8Cursor, utf8End) to ucs2Str[ucs2Cursor, ucs2Eos), both cursors are
+    // advanced. The input is validated, each byte of a malformed sequence and each code point outside the BMP
+    // is written as '?'. Returns the number of replacements.
+    s32 ToUcs2(utf8::pcrune utf8Str, u32& utf8Cursor, u32 utf8End, ucs2::prune ucs2Str, u32& ucs2Cursor, u32 ucs2Eos);
+
+    // The number of runes ToUcs2 writes for utf8Str[utf8Cursor, utf8End) when it is valid UTF-8, malformed
+    // input can decode to more runes since every byte of a malformed sequence is replaced
+    u32 ucs2_length(utf8::pcrune utf8Str, u32 utf8Cursor, u32 utf8End);
+
+    // Encodes ucs2Str[ucs2Cursor, ucs2End) as UTF-8 to utf8Str[utf8Cursor, utf8Eos), both cursors are advanced.
+    // A rune is only written when all of its bytes fit, no terminator is written.
+    void ToUtf8(ucs2::pcrune ucs2Str, u32& ucs2Cursor, u32 ucs2End, utf8::prune utf8Str, u32& utf8Cursor, u32 utf8Eos);
+
+    // The number of bytes ToUtf8 writes for ucs2Str[ucs2Cursor, ucs2End)
+    u32 utf8_length(ucs2::pcrune ucs2Str, u32 ucs2Cursor, u32 ucs2End);
+}  // namespace ncore
+
+#endif
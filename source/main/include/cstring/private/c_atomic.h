@@ -0,0 +1,89 @@
+#ifndef __CSTRING_PRIVATE_ATOMIC_H__
+#define __CSTRING_PRIVATE_ATOMIC_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+// Build with CSTRING_THREAD_SAFE defined as 1 to share strings between threads, the reference counts are
+// then atomic and the views of a string are tracked under a spinlock. Without it these are plain operations.
+#ifndef CSTRING_THREAD_SAFE
+#    define CSTRING_THREAD_SAFE 0
+#endif
+
+#if CSTRING_THREAD_SAFE
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#        define CSTRING_THREAD_LOCAL __declspec(thread)
+#    else
+#        define CSTRING_THREAD_LOCAL __thread
+#    endif
+#else
+#    define CSTRING_THREAD_LOCAL
+#endif
+
+namespace ncore
+{
+    namespace natomic
+    {
+#if CSTRING_THREAD_SAFE && defined(_MSC_VER)
+        inline s32  inc(s32* v) { return (s32)_InterlockedIncrement((long volatile*)v); }
+        inline s32  dec(s32* v) { return (s32)_InterlockedDecrement((long volatile*)v); }
+        inline s32  load(s32 const* v) { return *(s32 const volatile*)v; }
+        inline u16  load(u16 const* v) { return *(u16 const volatile*)v; }
+        inline void store(u16* v, u16 value) { _InterlockedExchange16((short volatile*)v, (short)value); }
+        inline bool try_lock(u16* lock) { return _InterlockedCompareExchange16((short volatile*)lock, 1, 0) == 0; }
+        inline void unlock(u16* lock) { _InterlockedExchange16((short volatile*)lock, 0); }
+        inline void pause() { _mm_pause(); }
+#elif CSTRING_THREAD_SAFE
+        inline s32  inc(s32* v) { return __atomic_add_fetch(v, 1, __ATOMIC_ACQ_REL); }
+        inline s32  dec(s32* v) { return __atomic_sub_fetch(v, 1, __ATOMIC_ACQ_REL); }
+        inline s32  load(s32 const* v) { return __atomic_load_n(v, __ATOMIC_ACQUIRE); }
+        inline u16  load(u16 const* v) { return __atomic_load_n(v, __ATOMIC_ACQUIRE); }
+        inline void store(u16* v, u16 value) { __atomic_store_n(v, value, __ATOMIC_RELEASE); }
+        inline bool try_lock(u16* lock) { return __atomic_exchange_n(lock, (u16)1, __ATOMIC_ACQUIRE) == 0; }
+        inline void unlock(u16* lock) { __atomic_store_n(lock, (u16)0, __ATOMIC_RELEASE); }
+#    if defined(__x86_64__) || defined(__i386__)
+        inline void pause() { __builtin_ia32_pause(); }
+#    else
+        inline void pause() {}
+#    endif
+#else
+        inline s32  inc(s32* v) { return ++(*v); }
+        inline s32  dec(s32* v) { return --(*v); }
+        inline s32  load(s32 const* v) { return *v; }
+        inline u16  load(u16 const* v) { return *v; }
+        inline void store(u16* v, u16 value) { *v = value; }
+        inline bool try_lock(u16*) { return true; }
+        inline void unlock(u16*) {}
+        inline void pause() {}
+#endif
+
+        // Spin until @lock is taken, the sections it guards are short (a few list operations)
+        inline void lock(u16* lock)
+        {
+            while (!try_lock(lock))
+            {
+                while (load(lock) != 0)
+                    pause();
+            }
+        }
+
+        // Holds @lock for the duration of a scope
+        class scoped_lock_t
+        {
+        public:
+            inline scoped_lock_t(u16* lock)
+                : m_lock(lock)
+            {
+                natomic::lock(m_lock);
+            }
+            inline ~scoped_lock_t() { natomic::unlock(m_lock); }
+
+        private:
+            u16* m_lock;
+        };
+    }  // namespace natomic
+}  // namespace ncore
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __CSTRING_PRIVATE_BMP_H__
+#define __CSTRING_PRIVATE_BMP_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    // Case mapping and classification of the Basic Multilingual Plane, a lookup is two table accesses
+    // without branches. The tables are generated by tools/gen_bmp_tables.py.
+    namespace nbmp
+    {
+        enum
+        {
+            c_alpha = 0x1,  // letter (Lu, Ll, Lt, Lm, Lo)
+            c_upper = 0x2,  // upper case letter (Lu)
+            c_lower = 0x4,  // lower case letter (Ll)
+            c_space = 0x8,  // White_Space
+        };
+
+        // The mappings are deltas, the code point plus the delta wraps to the mapped code point
+        struct props_t
+        {
+            u16 m_flags;
+            u16 m_upper;
+            u16 m_lower;
+            u16 m_title;
+        };
+
+        extern const u8      c_pages[256];
+        extern const u8      c_blocks[][256];
+        extern const props_t c_props[];
+
+        inline props_t const& props(uchar16 c) { return c_props[c_blocks[c_pages[c >> 8]][c & 0xFF]]; }
+
+        inline bool    is_alpha(uchar16 c) { return (props(c).m_flags & c_alpha) != 0; }
+        inline bool    is_upper(uchar16 c) { return (props(c).m_flags & c_upper) != 0; }
+        inline bool    is_lower(uchar16 c) { return (props(c).m_flags & c_lower) != 0; }
+        inline bool    is_space(uchar16 c) { return (props(c).m_flags & c_space) != 0; }
+        inline uchar16 to_upper(uchar16 c) { return (uchar16)(c + props(c).m_upper); }
+        inline uchar16 to_lower(uchar16 c) { return (uchar16)(c + props(c).m_lower); }
+        inline uchar16 to_title(uchar16 c) { return (uchar16)(c + props(c).m_title); }
+    }  // namespace nbmp
+}  // namespace ncore
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __CSTRING_PRIVATE_SIMD_H__
+#define __CSTRING_PRIVATE_SIMD_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+// SIMD support used by the string kernels, SSE2 is always available on x86-64 and NEON on AArch64.
+// AVX2 is only used when detected at runtime, functions using it are marked with CSTRING_TARGET_AVX2.
+#if defined(__x86_64__) || defined(_M_X64)
+#    define CSTRING_SIMD_SSE2
+#    include <immintrin.h>
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#        define CSTRING_TARGET_AVX2
+#    else
+#        define CSTRING_TARGET_AVX2 __attribute__((target("avx2")))
+#    endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#    define CSTRING_SIMD_NEON
+#    include <arm_neon.h>
+#endif
+
+namespace ncore
+{
+    namespace nsimd
+    {
+        // Index of the lowest/highest set bit, @v should not be 0
+#if defined(_MSC_VER)
+        inline s32 ctz32(u32 v)
+        {
+            unsigned long i;
+            _BitScanForward(&i, v);
+            return (s32)i;
+        }
+        inline s32 msb32(u32 v)
+        {
+            unsigned long i;
+            _BitScanReverse(&i, v);
+            return (s32)i;
+        }
+        inline s32 ctz64(u64 v)
+        {
+            unsigned long i;
+            _BitScanForward64(&i, v);
+            return (s32)i;
+        }
+        inline s32 msb64(u64 v)
+        {
+            unsigned long i;
+            _BitScanReverse64(&i, v);
+            return (s32)i;
+        }
+#else
+        inline s32 ctz32(u32 v) { return __builtin_ctz(v); }
+        inline s32 msb32(u32 v) { return 31 - __builtin_clz(v); }
+        inline s32 ctz64(u64 v) { return __builtin_ctzll(v); }
+        inline s32 msb64(u64 v) { return 63 - __builtin_clzll(v); }
+#endif
+
+        // Unaligned loads
+#if defined(_MSC_VER)
+        inline u64 load64(void const* p) { return *(u64 const __unaligned*)p; }
+        inline u32 load32(void const* p) { return *(u32 const __unaligned*)p; }
+#else
+        inline u64 load64(void const* p)
+        {
+            u64 v;
+            __builtin_memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        inline u32 load32(void const* p)
+        {
+            u32 v;
+            __builtin_memcpy(&v, p, sizeof(v));
+            return v;
+        }
+#endif
+
+        // The 128-bit product of @a and @b folded to 64 bits by xor-ing its halves
+#if defined(_MSC_VER) && defined(_M_X64)
+        inline u64 mul_fold64(u64 a, u64 b)
+        {
+            u64       hi;
+            u64 const lo = _umul128(a, b, &hi);
+            return lo ^ hi;
+        }
+#elif defined(_MSC_VER)
+        inline u64 mul_fold64(u64 a, u64 b) { return (a * b) ^ __umulh(a, b); }
+#else
+        inline u64 mul_fold64(u64 a, u64 b)
+        {
+            __uint128_t const r = (__uint128_t)a * b;
+            return (u64)r ^ (u64)(r >> 64);
+        }
+#endif
+
+#if defined(CSTRING_SIMD_SSE2)
+        inline bool detect_avx2()
+        {
+#    if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuid(info, 1);
+            if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)  // OS saves the YMM registers
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#    else
+            return __builtin_cpu_supports("avx2") != 0;
+#    endif
+        }
+
+        inline bool has_avx2()
+        {
+            static bool const s_avx2 = detect_avx2();
+            return s_avx2;
+        }
+#else
+        inline bool has_avx2() { return false; }
+#endif
+    }  // namespace nsimd
+}  // namespace ncore
+
+// The kernel @name_avx2, @name_sse2, @name_neon or @name_scalar that suits the CPU. It is meant to initialize
+// a function local static, so the selection is made once, also when several threads make the first call.
+#if defined(CSTRING_SIMD_SSE2)
+#    define CSTRING_SIMD_SELECT(name) (ncore::nsimd::has_avx2() ? name##_avx2 : name##_sse2)
+#elif defined(CSTRING_SIMD_NEON)
+#    define CSTRING_SIMD_SELECT(name) (name##_neon)
+#else
+#    define CSTRING_SIMD_SELECT(name) (name##_scalar)
+#endif
+
+#endif
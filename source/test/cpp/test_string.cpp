@@ -1,6 +1,7 @@
 #include "cbase/c_allocator.h"
 #include "cbase/c_runes.h"
 #include "cstring/c_string.h"
+#include "cstring/c_ucs2.h"
 #include "cunittest/cunittest.h"
 
 using namespace ncore;
@@ -69,6 +70,29 @@ UNITTEST_SUITE_BEGIN(test_string)
             CHECK_TRUE(c1[0] == '\0');
         }
 
+        UNITTEST_TEST(test_move_con)
+        {
+            string_t str("This is a string to move");
+            string_t v1 = str.find("string");
+            CHECK_EQUAL(6, v1.size());
+
+            string_t m1(static_cast<string_t&&>(v1));
+            CHECK_TRUE(v1.is_empty());
+            CHECK_EQUAL(6, m1.size());
+            CHECK_EQUAL('s', m1[0]);
+
+            string_t m2;
+            m2 = static_cast<string_t&&>(m1);
+            CHECK_TRUE(m1.is_empty());
+            CHECK_EQUAL(6, m2.size());
+            CHECK_EQUAL('g', m2[5]);
+
+            // The moved view is still a view on the original string
+            str.toUpper();
+            CHECK_EQUAL(6, m2.size());
+            CHECK_EQUAL('S', m2[0]);
+        }
+
         UNITTEST_TEST(test_construct_1_from_ascii_string_destruct)
         {
             string_t str("This is an ASCII string converted to UTF-16");
@@ -99,6 +123,93 @@ UNITTEST_SUITE_BEGIN(test_string)
             CHECK_TRUE(ascii[0] == 'A');
         }
 
+        UNITTEST_TEST(test_small_string)
+        {
+            string_t key("key");
+            CHECK_EQUAL(3, key.size());
+
+            // Slicing a small string moves its runes out so that they can be shared
+            string_t sl = key.slice();
+            key.toUpper();
+            CHECK_EQUAL(3, sl.size());
+            CHECK_EQUAL('K', sl[0]);
+
+            string_t tag("tag");
+            string_t tail(" is not small anymore");
+            tag.concatenate(tail);
+            CHECK_EQUAL(3 + 21, tag.size());
+            CHECK_EQUAL('t', tag[0]);
+            CHECK_EQUAL('e', tag[23]);
+
+            string_t copy(tag);
+            CHECK_TRUE(copy == tag);
+        }
+
+        UNITTEST_TEST(test_reserve)
+        {
+            string_t str;
+            str.reserve(64);
+            CHECK_EQUAL(0, str.size());
+            CHECK_TRUE(str.cap() >= 64);
+
+            string_t ab("ab");
+            for (s32 i = 0; i < 100; ++i)
+                str += ab;
+            CHECK_EQUAL(200, str.size());
+            CHECK_TRUE(str.cap() >= 200);
+            CHECK_EQUAL('a', str[198]);
+            CHECK_EQUAL('b', str[199]);
+
+            str.shrink_to_fit();
+            CHECK_EQUAL(200, str.cap());
+            CHECK_EQUAL(200, str.size());
+        }
+
+        UNITTEST_TEST(test_slab_alloc)
+        {
+            // Use the built-in slab allocator for the string objects
+            nstring_memory::exit();
+            nstring_memory::init(nullptr, Allocator);
+            {
+                string_t str("This is a string to slice into many views");
+                string_t views[64];
+                for (s32 i = 0; i < 64; ++i)
+                    views[i] = str(i % 8, (i % 8) + 4);
+                CHECK_EQUAL('T', views[0][0]);
+                CHECK_EQUAL('i', views[9][1]);
+
+                string_t small("small");
+                string_t copy(small);
+                CHECK_TRUE(copy == small);
+            }
+            nstring_memory::exit();
+            nstring_memory::init(Allocator, Allocator);
+        }
+
+        UNITTEST_TEST(test_arena_scope)
+        {
+            string_t kept;
+            {
+                nstring_memory::arena_scope_t scope(1024);
+
+                string_t str("A temporary string that lives in the arena");
+                string_t view = str.find("string");
+                CHECK_EQUAL(6, view.size());
+
+                string_t tmp("tmp");
+                tmp += str;
+                CHECK_EQUAL(3 + 42, tmp.size());
+
+                string_t persistent = str.find("temporary");
+                persistent.promote();
+                str.toUpper();
+                CHECK_EQUAL('t', persistent[0]);
+                kept = static_cast<string_t&&>(persistent);
+            }
+            CHECK_EQUAL(9, kept.size());
+            CHECK_EQUAL('y', kept[8]);
+        }
+
         UNITTEST_TEST(test_select)
         {
             string_t str("This is an ASCII string converted to UTF-16");
@@ -246,6 +357,51 @@ UNITTEST_SUITE_BEGIN(test_string)
             CHECK_EQUAL('p', c1[0]);
         }
 
+        UNITTEST_TEST(test_find_long)
+        {
+            // Matches beyond the first vector block, in the scalar tail and at the very end
+            string_t str("the quick brown fox jumps over the lazy dog, the quick brown cat");
+            CHECK_EQUAL(64, str.size());
+
+            string_t quick = str.find("quick");
+            CHECK_EQUAL(5, quick.size());
+            CHECK_EQUAL('q', quick[0]);
+
+            string_t last = str.findLast(string_t("quick"));
+            CHECK_EQUAL(5, last.size());
+            CHECK_EQUAL(49, str.selectUntil(last).size());
+
+            CHECK_TRUE(str.contains(string_t("lazy dog")));
+            CHECK_TRUE(str.contains(string_t("cat")));
+            CHECK_FALSE(str.contains(string_t("lazy cat")));
+            CHECK_TRUE(str.find("brown cat").size() == 9);
+            CHECK_TRUE(str.find("brown cow").is_empty());
+
+            string_t the = str.findLast(string_t("the"));
+            CHECK_EQUAL(3, the.size());
+            CHECK_EQUAL(45, str.selectUntil(the).size());
+            CHECK_EQUAL(4, str.selectUntil(quick).size());
+        }
+
+        UNITTEST_TEST(test_find_long_needle)
+        {
+            // Repetitive text where a shift-by-one search would compare most of the needle at every position
+            string_t str("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaaaaaaaaaaaab");
+            string_t needle("aaaaaaaaaaaab");
+
+            string_t first = str.find(needle);
+            CHECK_EQUAL(13, first.size());
+            CHECK_EQUAL(48, str.selectUntil(first).size());
+
+            string_t last = str.findLast(needle);
+            CHECK_EQUAL(13, last.size());
+            CHECK_EQUAL(61, str.selectUntil(last).size());
+
+            CHECK_FALSE(str.contains(string_t("aaaaaaaaaaaaaac")));
+            CHECK_EQUAL(2, str.findRemove(needle, 3));
+            CHECK_EQUAL(48, str.size());
+        }
+
         UNITTEST_TEST(test_insert)
         {
             string_t str1("This is text to change something in");
@@ -348,6 +504,37 @@ UNITTEST_SUITE_BEGIN(test_string)
             CHECK_EQUAL(v2.size(), 2);
         }
 
+        UNITTEST_TEST(test_find_replace_all)
+        {
+            string_t str;
+            str.concatenate_repeat(string_t("ab, "), 40);
+            CHECK_EQUAL(160, str.size());
+
+            string_t first = str.find("ab");
+            string_t last  = str.findLast(string_t(", "));
+
+            // Larger, all 40 occurrences
+            CHECK_EQUAL(40, str.findReplaceAll(string_t("ab"), string_t("abc")));
+            CHECK_EQUAL(200, str.size());
+            CHECK_EQUAL(3, first.size());
+            CHECK_EQUAL(2, last.size());
+            CHECK_EQUAL(198, str.selectUntil(last).size());
+
+            // Smaller, limited to the first 10
+            CHECK_EQUAL(10, str.findReplace(string_t("abc, "), string_t("-"), 10));
+            CHECK_EQUAL(160, str.size());
+            CHECK_EQUAL('-', str[0]);
+            CHECK_EQUAL('-', str[9]);
+            CHECK_EQUAL('a', str[10]);
+            CHECK_EQUAL(1, first.size());
+            CHECK_EQUAL(158, str.selectUntil(last).size());
+
+            // Remove the rest
+            CHECK_EQUAL(30, str.findRemove(string_t("abc, "), 100));
+            CHECK_TRUE(str == string_t("----------"));
+            CHECK_EQUAL(0, str.findReplaceAll(string_t("abc"), string_t("x")));
+        }
+
         UNITTEST_TEST(test_remove_any)
         {
             string_t str1("This is text to #change $something &in");
@@ -374,6 +561,516 @@ UNITTEST_SUITE_BEGIN(test_string)
             CHECK_TRUE(str1 == str2);
         }
 
+        UNITTEST_TEST(test_remove_char)
+        {
+            string_t str("--a--b---c--|--d--");
+            string_t head = str.selectUntil(str.find('|'));
+            string_t tail = str.find("d--");
+            string_t dash = str.find("---");
+            CHECK_EQUAL(12, head.size());
+
+            // Only remove from the head, the rest of the string has to move along
+            CHECK_EQUAL(9, head.removeChar('-'));
+            CHECK_TRUE(head == string_t("abc"));
+            CHECK_TRUE(str == string_t("abc|--d--"));
+            CHECK_TRUE(tail == string_t("d--"));
+            CHECK_TRUE(dash.is_empty());
+
+            CHECK_EQUAL(3, str.removeAnyChar(string_t("-|"), 3));
+            CHECK_TRUE(str == string_t("abcd--"));
+            CHECK_EQUAL(2, str.removeChar('-'));
+            CHECK_TRUE(tail == string_t("d"));
+            CHECK_EQUAL(0, str.removeChar('x'));
+        }
+
+        UNITTEST_TEST(test_many_views)
+        {
+            // A view per word, enough views for the string to park most of them in its view index
+            char text[100 * 4 + 1];
+            for (s32 i = 0; i < 100; ++i)
+            {
+                text[i * 4 + 0] = 'w';
+                text[i * 4 + 1] = (char)('0' + i / 10);
+                text[i * 4 + 2] = (char)('0' + i % 10);
+                text[i * 4 + 3] = ' ';
+            }
+            text[100 * 4] = '\0';
+
+            string_t str(text);
+            string_t words[100];
+            for (s32 i = 0; i < 100; ++i)
+                words[i] = str.select(i * 4, i * 4 + 3);
+
+            str.insertBeforeSelection(words[50], string_t("xx "));
+            str.insertAfterSelection(words[10], string_t("--"));
+            CHECK_EQUAL(10, str.findReplaceAll(string_t("w1"), string_t("W1")));
+            CHECK_EQUAL(101, str.removeChar(' '));
+            str.removeSelection(words[99]);
+            CHECK_EQUAL(99 * 3 + 2 + 2, str.size());
+
+            for (s32 i = 0; i < 99; ++i)
+            {
+                CHECK_EQUAL(3, words[i].size());
+                CHECK_EQUAL((uchar32)((i / 10) == 1 ? 'W' : 'w'), words[i][0]);
+                CHECK_EQUAL((uchar32)('0' + i / 10), words[i][1]);
+                CHECK_EQUAL((uchar32)('0' + i % 10), words[i][2]);
+            }
+            CHECK_TRUE(words[99].is_empty());
+            CHECK_TRUE(str.selectUntil(words[50]).endsWith(string_t("w49xx")));
+        }
+
+        UNITTEST_TEST(test_lazy_views)
+        {
+            // The views catch up with the edits when they are used, also after more edits than fit in the log
+            string_t str("abcdef");
+            string_t head = str.select(0, 1);
+            string_t cd   = str.select(2, 4);
+            string_t ef   = str.select(4, 6);
+            for (s32 i = 0; i < 40; ++i)
+            {
+                str.insertAfterSelection(head, string_t("x"));
+                if (i == 10)
+                    CHECK_TRUE(cd == string_t("cd"));
+            }
+            str.insertAfterSelection(cd, string_t("--"));
+            CHECK_EQUAL(48, str.size());
+            CHECK_TRUE(head == string_t("a"));
+            CHECK_TRUE(cd == string_t("cd"));
+            CHECK_TRUE(ef == string_t("ef"));
+            CHECK_TRUE(str.selectUntil(ef).endsWith(string_t("xbcd--")));
+        }
+
+        UNITTEST_TEST(test_large_edits)
+        {
+            // Edits at the front of a large string do not move the tail, the runes are flattened when read
+            string_t str;
+            str.concatenate_repeat(string_t("0123456789"), 5000);
+            string_t head = str.select(0, 1);
+            string_t tail = str.select(49990, 50000);
+            for (s32 i = 0; i < 300; ++i)
+                str.insertAfterSelection(head, string_t("ab"));
+            str.removeSelection(str.select(1, 101));
+            CHECK_EQUAL(50500, str.size());
+            CHECK_EQUAL((uchar32)'a', str[1]);
+            CHECK_EQUAL((uchar32)'1', str[501]);
+            CHECK_EQUAL((uchar32)'9', str[50499]);
+            CHECK_TRUE(tail == string_t("0123456789"));
+            str.flatten();
+            CHECK_EQUAL(501, str.selectUntil(str.find("123")).size());
+            CHECK_TRUE(str.endsWith(string_t("6789")));
+        }
+
+        UNITTEST_TEST(test_piece_edits)
+        {
+            // Many edits far apart keep the runes in pieces, they are searched and compared without flattening
+            string_t a;
+            string_t b;
+            a.concatenate_repeat(string_t("0123456789"), 5000);
+            b.concatenate_repeat(string_t("0123456789"), 5000);
+            for (s32 i = 0; i < 800; ++i)
+            {
+                a.insertBeforeSelection(a.select(40000 - 40 * i, 40000 - 40 * i), string_t("xy"));
+                b.insertBeforeSelection(b.select(40000 - 40 * i, 40000 - 40 * i), string_t("xy"));
+            }
+            CHECK_EQUAL(51600, a.size());
+            CHECK_EQUAL(8039, a.selectUntil(a.find("9xy0")).size());
+            CHECK_EQUAL(41597, a.selectUntil(a.findLast(string_t("9xy0"))).size());
+            CHECK_EQUAL(8040, a.selectUntil((uchar32)'x').size());
+            CHECK_EQUAL(41599, a.selectUntil(a.findLast((uchar32)'y')).size());
+            CHECK_TRUE(a == b);
+            CHECK_TRUE(a.endsWith(string_t("89")));
+
+            b.removeSelection(b.select(41599, 41600));
+            CHECK_TRUE(a > b);
+            CHECK_EQUAL((uchar32)'x', b[41598]);
+            CHECK_EQUAL((uchar32)'0', b[41599]);
+
+            a.toUpper();
+            CHECK_TRUE(a.find("xy").is_empty());
+            CHECK_EQUAL(8039, a.selectUntil(a.find("9XY0")).size());
+            CHECK_TRUE(a.isUpper());
+            a.flatten();
+            CHECK_EQUAL(41597, a.selectUntil(a.findLast(string_t("9XY0"))).size());
+        }
+
+        UNITTEST_TEST(test_gap_edits)
+        {
+            // Edits that follow each other keep a gap at the cursor, the views and reads stay logical
+            string_t str;
+            str.concatenate_repeat(string_t("abcdefghij"), 400);
+            string_t cursor = str.select(100, 100);
+            string_t word   = str.select(2000, 2010);
+            for (s32 i = 0; i < 50; ++i)
+            {
+                str.insertBeforeSelection(cursor, string_t("<>"));
+                str.removeSelection(str.select(102 + 2 * i, 103 + 2 * i));
+            }
+            CHECK_EQUAL(4050, str.size());
+            CHECK_EQUAL((uchar32)'<', str[100]);
+            CHECK_EQUAL((uchar32)'a', str[200]);
+            CHECK_EQUAL((uchar32)'j', str[4049]);
+            CHECK_TRUE(word == string_t("abcdefghij"));
+            CHECK_EQUAL(100, str.selectUntil(str.find("<")).size());
+            CHECK_EQUAL(199, str.selectUntil(str.find(">a")).size());
+        }
+
+        UNITTEST_TEST(test_freeze)
+        {
+            string_t str("key = value");
+            string_t key = str.select(0, 3);
+            str.freeze();
+            CHECK_TRUE(str.is_frozen());
+            CHECK_TRUE(key.is_frozen());
+
+            // Modifying a view of frozen data gives it its own runes, the other views do not change
+            string_t value = str.select(6, 11);
+            value.toUpper();
+            value.removeSelection(value.select(0, 1));
+            CHECK_FALSE(value.is_frozen());
+            CHECK_TRUE(value == string_t("ALUE"));
+            CHECK_TRUE(str == string_t("key = value"));
+
+            // The selection is on the frozen data, it is moved to the copy
+            key.insertReplaceSelection(str.select(1, 2), string_t("E"));
+            CHECK_TRUE(key == string_t("kEy"));
+            CHECK_TRUE(str.select(0, 3) == string_t("key"));
+
+            // A string on the heap gets its copy on the heap, also while an arena scope is active
+            string_t heap("The runes of this frozen string are on the heap");
+            heap.freeze();
+            {
+                nstring_memory::arena_scope_t scope(1024);
+                heap.toUpper();
+            }
+            char asciiStr[64];
+            heap.toAscii(asciiStr, 64);
+            CHECK_TRUE(ascii::compare(asciiStr, "THE RUNES OF THIS FROZEN STRING ARE ON THE HEAP") == 0);
+        }
+
+        UNITTEST_TEST(test_cow_clone)
+        {
+            string_t str("the quick brown fox");
+            string_t fox = str.select(16, 19);
+            string_t copy = str.clone();
+            CHECK_TRUE(copy == str);
+
+            // Modifying the string leaves the clone as it was, views of the string follow the string
+            str.toUpper();
+            CHECK_TRUE(str == string_t("THE QUICK BROWN FOX"));
+            CHECK_TRUE(fox == string_t("FOX"));
+            CHECK_TRUE(copy == string_t("the quick brown fox"));
+
+            // A view of a clone follows the clone
+            string_t clone2 = copy.clone();
+            string_t brown  = clone2.select(10, 15);
+            clone2.removeSelection(clone2.select(0, 4));
+            CHECK_TRUE(clone2 == string_t("quick brown fox"));
+            CHECK_TRUE(brown == string_t("brown"));
+            CHECK_TRUE(copy == string_t("the quick brown fox"));
+
+            string_t copy2(copy);
+            copy.toUpper();
+            CHECK_TRUE(copy == string_t("THE QUICK BROWN FOX"));
+            CHECK_TRUE(copy2 == string_t("the quick brown fox"));
+
+            // The runes of a clone on the heap stay on the heap when the string is modified in an arena scope
+            string_t jumps("jumps over the lazy dog");
+            string_t clone3 = jumps.clone();
+            {
+                nstring_memory::arena_scope_t scope(1024);
+                jumps.toUpper();
+            }
+            CHECK_TRUE(jumps == string_t("JUMPS OVER THE LAZY DOG"));
+            CHECK_TRUE(clone3 == string_t("jumps over the lazy dog"));
+        }
+
+        UNITTEST_TEST(test_intern)
+        {
+            string_t name("identifier_name");
+            string_t other("an identifier_name");
+            string_t same = other.select(3, 18);
+            CHECK_FALSE(name.is_interned());
+
+            name.intern();
+            same.intern();
+            CHECK_TRUE(name.is_interned());
+            CHECK_TRUE(same.is_interned());
+            CHECK_TRUE(name == same);
+            CHECK_TRUE(other == string_t("an identifier_name"));
+
+            // A slice of an interned string is not interned, modifying an interned string gives it its own runes
+            string_t part = name.select(0, 10);
+            CHECK_FALSE(part.is_interned());
+            part.intern();
+            CHECK_TRUE(part != name);
+
+            same.toUpper();
+            CHECK_FALSE(same.is_interned());
+            CHECK_TRUE(same == string_t("IDENTIFIER_NAME"));
+            CHECK_TRUE(name == string_t("identifier_name"));
+        }
+
+        UNITTEST_TEST(test_hash)
+        {
+            string_t str("hash: the same runes give the same hash");
+            string_t same = str.select(6, 14);
+            CHECK_TRUE(same.hash() == string_t("the same").hash());
+            CHECK_TRUE(str.hash() != same.hash());
+            CHECK_TRUE(string_t().hash() == string_t("").hash());
+
+            // The cached hash is dropped when the string is modified
+            u64 const before = str.hash();
+            CHECK_TRUE(str.hash() == before);
+            str.toUpper();
+            CHECK_TRUE(str.hash() != before);
+            str.toLower();
+            CHECK_TRUE(str.hash() == before);
+
+            // Long strings are hashed in stripes
+            string_t text;
+            for (s32 i = 0; i < 200; ++i)
+                text += string_t("0123456789");
+            string_t tail = text.select(10, 2000);
+            string_t copy = tail.clone();
+            copy.toUpper();
+            CHECK_TRUE(tail.hash() == text.select(0, 1990).hash());
+            CHECK_TRUE(copy.hash() == tail.hash());
+            copy.removeSelection(copy.select(0, 1));
+            CHECK_TRUE(copy.hash() != tail.hash());
+        }
+
+        UNITTEST_TEST(test_compare)
+        {
+            // Lexicographic, a prefix comes before the longer string
+            CHECK_TRUE(string_t("apple").compare(string_t("banana")) < 0);
+            CHECK_TRUE(string_t("banana").compare(string_t("apple")) > 0);
+            CHECK_TRUE(string_t("app").compare(string_t("apple")) < 0);
+            CHECK_TRUE(string_t("apple").compare(string_t("apple")) == 0);
+            CHECK_TRUE(string_t().compare(string_t("a")) < 0);
+            CHECK_TRUE(string_t("b") > string_t("abcdefghijklmnopqrstuvwxyz"));
+
+            // The first difference can be anywhere in a long string
+            string_t a("the first mismatching rune decides the order of two strings");
+            string_t b("the first mismatching rune decides the order of two strings!");
+            CHECK_TRUE(a < b);
+            CHECK_TRUE(a == b.select(0, a.size()));
+            b.insertReplaceSelection(b.select(40, 41), string_t("T"));
+            CHECK_TRUE(b < a);
+            CHECK_TRUE(a >= b);
+            CHECK_FALSE(a.isEqual(b));
+        }
+
+        UNITTEST_TEST(test_case_blocks)
+        {
+            // Longer than a vector block, the case of the tail is mapped as well
+            string_t str("the Quick brown fox jumps over the lazy dog, 1234 [@`{] times");
+            string_t upper = str.clone();
+            upper.toUpper();
+            CHECK_TRUE(upper == string_t("THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG, 1234 [@`{] TIMES"));
+            CHECK_TRUE(upper.isUpper());
+            CHECK_FALSE(upper.isLower());
+
+            upper.toLower();
+            CHECK_TRUE(upper == string_t("the quick brown fox jumps over the lazy dog, 1234 [@`{] times"));
+            CHECK_TRUE(upper.isLower());
+
+            string_t words("some words,with-separators");
+            words.capitalize(string_t(",-"));
+            CHECK_TRUE(words == string_t("some words,WITH-SEPARATORS"));
+        }
+
+        UNITTEST_TEST(test_case_bmp)
+        {
+            // Fullwidth a, Greek alpha, ideographic space and Cyrillic be
+            string_t str("xa,b");
+            str.replaceAnyChar(string_t("x"), 0xFF41);
+            str.replaceAnyChar(string_t("a"), 0x03B1);
+            str.replaceAnyChar(string_t(","), 0x3000);
+            str.replaceAnyChar(string_t("b"), 0x0431);
+            CHECK_TRUE(str.isLower());
+
+            str.toUpper();
+            CHECK_EQUAL(0xFF21, str[0]);
+            CHECK_EQUAL(0x0391, str[1]);
+            CHECK_EQUAL(0x3000, str[2]);
+            CHECK_EQUAL(0x0411, str[3]);
+            CHECK_TRUE(str.isUpper());
+
+            str.toLower();
+            CHECK_EQUAL(0xFF41, str[0]);
+            CHECK_EQUAL(0x0431, str[3]);
+
+            // The ideographic space separates the words
+            str.capitalize();
+            CHECK_EQUAL(0xFF21, str[0]);
+            CHECK_EQUAL(0x0411, str[3]);
+
+            // Title case differs from upper case for the digraphs
+            string_t dz("dz");
+            dz.replaceAnyChar(string_t("d"), 0x01C6);
+            dz.capitalize();
+            CHECK_EQUAL(0x01C5, dz[0]);
+
+            // The mappings are the simple ones, U+0130 lowers to i and the Greek letters with ypogegrammeni
+            // upper to the letter with prosgegrammeni, which is also their title case
+            string_t simple("ab");
+            simple.replaceAnyChar(string_t("a"), 0x0130);
+            simple.replaceAnyChar(string_t("b"), 0x1F80);
+            simple.toLower();
+            CHECK_EQUAL(0x0069, simple[0]);
+            CHECK_EQUAL(0x1F80, simple[1]);
+            simple.toUpper();
+            CHECK_EQUAL(0x0049, simple[0]);
+            CHECK_EQUAL(0x1F88, simple[1]);
+            for (uchar32 c = 0x1F80; c <= 0x1FFC; ++c)
+            {
+                string_t upper("_");
+                string_t title("_");
+                upper.replaceAnyChar(string_t("_"), c);
+                title.replaceAnyChar(string_t("_"), c);
+                upper.toUpper();
+                title.capitalize();
+                CHECK_EQUAL(title[0], upper[0]);
+            }
+
+            // Trim removes Unicode white space
+            string_t word("__word_");
+            word.replaceAnyChar(string_t("_"), 0x3000, 1);
+            word.replaceAnyChar(string_t("_"), 0x00A0);
+            word.trim();
+            CHECK_TRUE(word == string_t("word"));
+        }
+
+        UNITTEST_TEST(test_to_ucs2)
+        {
+            // ASCII long enough for the vector blocks, followed by Greek, CJK, an emoji and a stray byte
+            static const char utf8[] = "the quick brown fox jumps over the lazy dog \xCE\xB1\xCE\xB2 \xE4\xB8\xAD\xE6\x96\x87 \xF0\x9F\x98\x80\xFF! and some more ASCII text";
+            u32 const         len    = sizeof(utf8) - 1;
+
+            uchar16 ucs2[128];
+            u32     src      = 0;
+            u32     dst      = 0;
+            s32     replaced = ToUcs2((utf8::pcrune)utf8, src, len, ucs2, dst, 128);
+            CHECK_EQUAL(2, replaced);
+            CHECK_EQUAL(len, src);
+            CHECK_EQUAL(len - 2 - 4 - 3, dst);
+            CHECK_EQUAL('t', ucs2[0]);
+            CHECK_EQUAL(0x03B1, ucs2[44]);
+            CHECK_EQUAL(0x03B2, ucs2[45]);
+            CHECK_EQUAL(0x4E2D, ucs2[47]);
+            CHECK_EQUAL(0x6587, ucs2[48]);
+            CHECK_EQUAL('?', ucs2[50]);
+            CHECK_EQUAL('?', ucs2[51]);
+            CHECK_EQUAL('!', ucs2[52]);
+            CHECK_EQUAL('t', ucs2[dst - 1]);
+
+            // The output is full before the input is consumed, a sequence is never split
+            src      = 0;
+            dst      = 0;
+            replaced = ToUcs2((utf8::pcrune)utf8, src, len, ucs2, dst, 46);
+            CHECK_EQUAL(0, replaced);
+            CHECK_EQUAL(46, dst);
+            CHECK_EQUAL(48, src);
+        }
+
+        UNITTEST_TEST(test_to_utf8)
+        {
+            static const char utf8[] = "the quick brown fox jumps over the lazy dog \xCE\xB1\xCE\xB2 \xE4\xB8\xAD\xE6\x96\x87, the \xC3\xA9t\xC3\xA9 and some more ASCII text";
+            u32 const         len    = sizeof(utf8) - 1;
+
+            uchar16 ucs2[128];
+            u32     src = 0;
+            u32     dst = 0;
+            CHECK_EQUAL(0, ToUcs2((utf8::pcrune)utf8, src, len, ucs2, dst, 128));
+            u32 const runes = dst;
+            CHECK_EQUAL(len, utf8_length(ucs2, 0, runes));
+
+            // Round trip into an exactly sized buffer
+            utf8::rune bytes[128];
+            src = 0;
+            dst = 0;
+            ToUtf8(ucs2, src, runes, bytes, dst, len);
+            CHECK_EQUAL(runes, src);
+            CHECK_EQUAL(len, dst);
+            for (u32 i = 0; i < len; ++i)
+                CHECK_EQUAL((utf8::rune)utf8[i], bytes[i]);
+
+            // A rune is not split when the output is full
+            src = 0;
+            dst = 0;
+            ToUtf8(ucs2, src, runes, bytes, dst, 45);
+            CHECK_EQUAL(44, dst);
+            CHECK_EQUAL(44, src);
+
+            string_t str("a string with some a's in it");
+            str.replaceAnyChar(string_t("a"), 0x03B1);
+            CHECK_EQUAL(str.size() + 2, str.utf8Size());
+            char out[64];
+            str.toUtf8(out, sizeof(out));
+            CHECK_EQUAL((char)0xCE, out[0]);
+            CHECK_EQUAL((char)0xB1, out[1]);
+            CHECK_EQUAL(' ', out[2]);
+            CHECK_EQUAL('\0', out[str.utf8Size()]);
+        }
+
+        UNITTEST_TEST(test_from_utf8)
+        {
+            static const char greek[] = "\xCE\xB1\xCE\xB2\xCE\xB3";
+            string_t          small(greek, sizeof(greek) - 1);
+            CHECK_EQUAL(3, small.size());
+            CHECK_EQUAL(0x03B1, small[0]);
+            CHECK_EQUAL(0x03B3, small[2]);
+
+            static const char text[] = "some ASCII followed by \xE4\xB8\xAD\xE6\x96\x87 and more text after it";
+            string_t          str(text, sizeof(text) - 1);
+            CHECK_EQUAL(sizeof(text) - 1 - 4, str.size());
+            CHECK_EQUAL(0x4E2D, str[23]);
+            CHECK_EQUAL(0x6587, str[24]);
+            CHECK_EQUAL((s32)sizeof(text) - 1, str.utf8Size());
+
+            // Stray continuation bytes decode to more runes than were counted
+            static const char stray[] = "\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80 and text";
+            str.assign_utf8(stray, sizeof(stray) - 1);
+            CHECK_EQUAL(sizeof(stray) - 1, str.size());
+            CHECK_EQUAL('?', str[19]);
+            CHECK_TRUE(str.find("and text").size() == 8);
+
+            str.assign_utf8(text, 4);
+            CHECK_TRUE(str == string_t("some"));
+            str.assign_utf8(text, 0);
+            CHECK_TRUE(str.is_empty());
+        }
+
+        UNITTEST_TEST(test_charset)
+        {
+            charset_t set(".,;");
+            CHECK_TRUE(set.contains('.'));
+            CHECK_TRUE(set.contains(';'));
+            CHECK_FALSE(set.contains('a'));
+            CHECK_FALSE(set.contains(0x2E + 0x100));
+
+            set.add(0x00E9);  // e acute
+            set.add(0x2014);  // em dash
+            set.add(0x3002);  // ideographic full stop
+            CHECK_TRUE(set.contains(0x00E9));
+            CHECK_TRUE(set.contains(0x2014));
+            CHECK_TRUE(set.contains(0x3002));
+            CHECK_FALSE(set.contains(0x2015));
+            CHECK_FALSE(set.contains(0x3102));
+
+            string_t str("one, two; three.");
+            CHECK_EQUAL(',', str.findOneOf(set)[0]);
+            CHECK_EQUAL('.', str.findOneOfLast(set)[0]);
+            CHECK_EQUAL(3, str.replaceAnyChar(set, '_'));
+            CHECK_TRUE(str == string_t("one_ two_ three_"));
+
+            // Trim with a set taken from a view that does not start at 0
+            string_t trimset = string_t("xyz_ ").find("_ ");
+            string_t word    = str.find("two_ ");
+            word.trimRight(trimset);
+            CHECK_TRUE(word == string_t("two"));
+        }
+
         UNITTEST_TEST(test_remove_any2)
         {
             string_t str1("This is text to ##change $$something &&in");
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# Generates source/main/cpp/c_bmp.cpp, the two-level case mapping and classification tables of the
+# Basic Multilingual Plane, from the Unicode database that comes with Python (unicodedata).
+#
+#   python3 tools/gen_bmp_tables.py [UnicodeData.txt] > source/main/cpp/c_bmp.cpp
+#
+# The case mappings are the simple ones of UnicodeData.txt (fields 12, 13 and 14), which map a code point
+# to a single code point. When that file is given its mappings are used, it should be of the same version
+# as unicodedata. Otherwise the mapping of Python is used when it is a single code point, it then equals
+# the simple one, and SIMPLE holds the simple mappings where Python gives more than one code point.
+#
+# A code point is looked up as c_props[c_blocks[c_pages[c >> 8]][c & 0xFF]], blocks with the same
+# content are stored once. The mappings are stored as deltas so that a run of letters with the
+# same distance to their other case (e.g. Cyrillic) shares one entry.
+import sys
+import unicodedata
+
+ALPHA, UPPER, LOWER, SPACE = 1, 2, 4, 8
+
+# The White_Space property (PropList.txt), str.isspace() also includes the information separators
+WHITE_SPACE = set([0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x20, 0x85, 0xA0, 0x1680, 0x2028, 0x2029, 0x202F, 0x205F, 0x3000])
+WHITE_SPACE.update(range(0x2000, 0x200B))
+
+
+# The simple mappings (upper, lower, title) that differ from the code point itself for the code points whose
+# full mapping (SpecialCasing.txt) is more than one code point. The others, e.g. the upper case of U+00DF,
+# have no simple mapping and map to themselves.
+SIMPLE = {0x0130: (None, 0x0069, None), 0x1FB3: (0x1FBC, None, None), 0x1FC3: (0x1FCC, None, None), 0x1FF3: (0x1FFC, None, None)}
+for first in (0x1F80, 0x1F90, 0x1FA0):
+    for c in range(first, first + 8):
+        SIMPLE[c] = (c + 8, None, None)
+
+UNICODE_DATA = {}  # code point -> (upper, lower, title) of UnicodeData.txt
+
+
+def load_unicode_data(path):
+    with open(path) as f:
+        for line in f:
+            fields = line.rstrip('\n').split(';')
+            c = int(fields[0], 16)
+            if c >= 0x10000:
+                continue
+            upper = int(fields[12], 16) if fields[12] else c
+            lower = int(fields[13], 16) if fields[13] else c
+            title = int(fields[14], 16) if fields[14] else upper  # an empty title case is the upper case
+            UNICODE_DATA[c] = (upper, lower, title)
+
+
+def simple(c, s, i):
+    if UNICODE_DATA:
+        m = UNICODE_DATA.get(c, (c, c, c))[i]
+    elif len(s) == 1:
+        m = ord(s)
+    else:
+        m = SIMPLE.get(c, (None, None, None))[i]
+    # Only mappings within the BMP
+    return m if m is not None and m < 0x10000 else c
+
+
+def props(c):
+    if 0xD800 <= c <= 0xDFFF:
+        return (0, 0, 0, 0)
+    ch = chr(c)
+    cat = unicodedata.category(ch)
+    flags = 0
+    if cat in ('Lu', 'Ll', 'Lt', 'Lm', 'Lo'):
+        flags |= ALPHA
+    if cat == 'Lu':
+        flags |= UPPER
+    if cat == 'Ll':
+        flags |= LOWER
+    if c in WHITE_SPACE:
+        flags |= SPACE
+    upper = simple(c, ch.upper(), 0)
+    lower = simple(c, ch.lower(), 1)
+    title = simple(c, ch.title(), 2)
+    return (flags, (upper - c) & 0xFFFF, (lower - c) & 0xFFFF, (title - c) & 0xFFFF)
+
+
+def main():
+    if len(sys.argv) > 1:
+        load_unicode_data(sys.argv[1])
+
+    records = {(0, 0, 0, 0): 0}
+    blocks = {}
+    block_list = []
+    pages = []
+    for page in range(256):
+        block = []
+        for c in range(page * 256, page * 256 + 256):
+            p = props(c)
+            if p not in records:
+                records[p] = len(records)
+            block.append(records[p])
+        block = tuple(block)
+        if block not in blocks:
+            blocks[block] = len(block_list)
+            block_list.append(block)
+        pages.append(blocks[block])
+    assert len(block_list) <= 256 and len(records) <= 256
+
+    out = sys.stdout
+    out.write('// Generated by tools/gen_bmp_tables.py from the Unicode %s database, do not edit\n' % unicodedata.unidata_version)
+    out.write('#include "ccore/c_target.h"\n')
+    out.write('#include "cstring/private/c_bmp.h"\n\n')
+    out.write('namespace ncore\n{\n    namespace nbmp\n    {\n')
+    out.write('        const u8 c_pages[256] = {\n')
+    for i in range(0, 256, 32):
+        out.write('            ' + ', '.join('%d' % p for p in pages[i:i + 32]) + ',\n')
+    out.write('        };\n\n')
+    out.write('        const u8 c_blocks[%d][256] = {\n' % len(block_list))
+    for block in block_list:
+        out.write('            {\n')
+        for i in range(0, 256, 32):
+            out.write('                ' + ', '.join('%d' % r for r in block[i:i + 32]) + ',\n')
+        out.write('            },\n')
+    out.write('        };\n\n')
+    out.write('        const props_t c_props[%d] = {\n' % len(records))
+    for rec, _ in sorted(records.items(), key=lambda kv: kv[1]):
+        out.write('            {0x%x, 0x%04x, 0x%04x, 0x%04x},\n' % rec)
+    out.write('        };\n')
+    out.write('    }  // namespace nbmp\n}  // namespace ncore\n')
+    sys.stderr.write('%d blocks, %d records\n' % (len(block_list), len(records)))
+
+
+if __name__ == '__main__':
+    main()